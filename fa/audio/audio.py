@@ -32,45 +32,74 @@ import optparse
 import subprocess
 import os
 import sys
+import wave
 import fcntl
 import math
 import numpy
 
 import cothread
 from fa import falib
+from fa.audio import resample
+from fa.audio import shift
+from fa.audio import mix
+from fa.audio import pipeline
 
 
-# Offset applied to user programmed volume, in dB.
-volume_offset = 50
-
 DEFAULT_LOCATION = 'SR'
 
+# Data is read from the archiver in blocks of this many samples.
+BLOCK_SIZE = 1000
+
+# Playback latency: the rate controller aims to keep this much resampled audio
+# (in seconds) waiting to be played, and the ring buffer can hold RING_SECONDS.
+TARGET_LATENCY = 0.2
+RING_SECONDS = 1
+
+# Rendering upsamples the data by at most this factor.  The resampler's work
+# areas grow with the upsampling factor, and beyond this the audio is almost
+# entirely interpolated.
+MAX_UPSAMPLE = 16
+
+# Length of the aplay buffer in microseconds.
+APLAY_BUFFER = 100000
+
+# Two channels of S32_LE audio
+FRAME_BYTES = 8
+
+# Linux specific fcntl for setting the pipe size, not exported by fcntl until
+# Python 3.10.
+F_SETPIPE_SZ = getattr(fcntl, 'F_SETPIPE_SZ', 1031)
+
 
 class Sub:
     '''Manages subscription to archiver.  Received data is written to an event
-    queue, and we take care not to let the length of the queue grow.'''
+    queue.  The player adjusts its playback rate to keep up, so blocks are only
+    dropped if the player has stalled completely.'''
+
+    # Longest queue we allow before discarding data, in blocks.
+    MAX_QUEUE = 20
 
-    def __init__(self, queue, bpm, server):
+    def __init__(self, queue, ids, server):
         self.queue = queue
         self.server = server
 
         self.running = True
-        self.process = cothread.Spawn(self.__subscriber, bpm)
-        self.bpm = bpm
+        self.ids = sorted(ids)
+        self.process = cothread.Spawn(self.__subscriber)
 
-    def __subscriber(self, bpm):
+    def __subscriber(self):
         try:
-            sub = server.subscription([bpm])
+            sub = self.server.subscription(self.ids)
         except Exception as error:
             print(f'Error {error} connecting to archiver')
             os._exit(0)
 
         while self.running:
-            block = sub.read(1000)
-            if len(self.queue) <= 1:
-                # Drop extra blocks to ensure we don't run too far ahead of the
-                # player, which is deliberately running about 0.7% slower.
-                self.queue.Signal(block)
+            block = sub.read(BLOCK_SIZE)
+            if len(self.queue) < self.MAX_QUEUE:
+                # Each block is tagged with its ids in case the subscription
+                # changes while blocks are still queued.
+                self.queue.Signal((self.ids, block))
         sub.close()
 
     def close(self):
@@ -79,68 +108,94 @@ class Sub:
 
 
 class Player:
-    def __init__(self, bpm, server, volume):
+    '''Plays FA data through aplay.  Data from the subscription is passed
+    through the audio pipeline and written to a ring buffer by the player task,
+    and the writer task feeds the ring buffer to aplay as fast as it will take
+    it.  The resampling ratio is trimmed to hold the amount of buffered audio at
+    TARGET_LATENCY.'''
+
+    def __init__(self, bpms, server, volume, rate, band = None,
+            subscribe = (), pans = None):
         self.server = server
-        self.volume = volume
-        self.channels = 'b'
-
-        cothread.Spawn(self.player)
-
+        self.rate = rate
         self.queue = cothread.EventQueue()
-        self.sub = None
 
-        # Hang onto input volume level history for last 5 seconds.
-        self.mvolume = 100 * numpy.ones(50)
-        self.set_bpm(bpm)
+        # Buffers for the audio pipeline are all allocated here.
+        nominal = server.sample_frequency / rate
+        self.audio = pipeline.audio_pipeline(
+            server.sample_frequency, nominal, volume, pans or {}, BLOCK_SIZE)
+        self.controller = resample.rate_controller(nominal, TARGET_LATENCY)
+        self.ring = resample.ring_buffer(
+            FRAME_BYTES * int(RING_SECONDS * rate))
+        self.ready = cothread.Event()
+        self.overruns = 0
+
+        self.sub = Sub(self.queue, set(subscribe) | set(bpms), self.server)
+        self.set_bpms(bpms)
+        if band:
+            self.audio.set_shift(*band)
 
-    def set_bpm(self, bpm):
-        if self.sub:
+        cothread.Spawn(self.player)
+        cothread.Spawn(self.writer)
+
+    def set_bpms(self, bpms):
+        '''Selects the FA ids to play.  If they are all already subscribed
+        this takes effect on the next block, otherwise we have to resubscribe
+        to include the new ids.'''
+        missing = set(bpms) - set(self.sub.ids)
+        if missing:
             self.sub.close()
-        self.sub = Sub(self.queue, bpm, self.server)
+            self.sub = Sub(self.queue, set(self.sub.ids) | missing, self.server)
+        self.audio.selected = sorted(bpms)
         # Reset volume history when changing FA id
-        self.mvolume[:] = 100
-
-
-    # Rescales audio to avoid clipping after volume scaling.
-    def rescale(self, block):
-        # First remove any DC component as this makes no sense for sound
-        block = numpy.float32(block)
-        block -= block.mean(axis = 0)
-
-        # Compute the available dynamic range
-        range = numpy.amax(numpy.abs(block))
-        vscale = 10 ** ((self.volume + volume_offset) / 20.)
-        mscale = (2**31 - 1.) / range
-        block *= min(vscale, mscale)
+        self.audio.reset_volume()
 
-        # Convert mscale into a measure of raw volume
-        mvol = 20 * numpy.log10(mscale) - volume_offset
-        self.mvolume = numpy.roll(self.mvolume, 1)
-        self.mvolume[0] = mvol
-
-        return block
 
+    def latency(self):
+        '''Returns the amount of data waiting to be played in seconds.'''
+        return \
+            len(self.queue) * BLOCK_SIZE / self.server.sample_frequency + \
+            self.ring.level / (FRAME_BYTES * self.rate)
 
     def player(self):
+        while True:
+            ids, block = self.queue.Wait()
+            # Blocks queued before a resubscription may not contain the newly
+            # selected ids, and are dropped.
+            if not set(self.audio.selected) <= set(ids):
+                continue
+            self.audio.resampler.ratio = \
+                self.controller.update(self.latency())
+            if self.ring.write(self.audio.process(ids, block)):
+                self.overruns += 1
+            self.ready.Signal()
+
+    def writer(self):
         aplay = subprocess.Popen(
-            ['aplay', '-c2', '-fS32_LE', '-r10000'], stdin = subprocess.PIPE)
+            ['aplay', '-c2', '-fS32_LE', '-r%d' % self.rate,
+                '-B%d' % APLAY_BUFFER],
+            stdin = subprocess.PIPE)
         fcntl.fcntl(aplay.stdin, fcntl.F_SETFL, os.O_NONBLOCK)
+        # Keep the pipe small so that it doesn't add to our latency.
+        try:
+            fcntl.fcntl(aplay.stdin, F_SETPIPE_SZ, 4096)
+        except OSError:
+            pass
 
-        to_write = b''
+        prime = FRAME_BYTES * int(TARGET_LATENCY * self.rate)
         while True:
-            block = self.queue.Wait()[:,0,:]
-            if self.channels == 'l':
-                block[:, 1] = block[:, 0]
-            elif self.channels == 'r':
-                block[:, 0] = block[:, 1]
-
-            block = self.rescale(block)
-
-            to_write = to_write + block.astype('l').tobytes()
-            while len(to_write) > 4096:
+            # On startup, or if we ever run dry, wait for the buffer to fill
+            # before restarting playback.
+            while self.ring.level < prime:
+                self.ready.Wait()
+            while self.ring.level:
                 assert cothread.poll_list([(aplay.stdin, cothread.POLLOUT)])
-                written = os.write(aplay.stdin.fileno(), to_write)
-                to_write = to_write[written:]
+                try:
+                    written = os.write(
+                        aplay.stdin.fileno(), self.ring.readable())
+                except BlockingIOError:
+                    written = 0
+                self.ring.consume(written)
 
 
     # Command definitions
@@ -154,33 +209,46 @@ class Player:
         sys.exit(0)
 
     def command_b(self, arg):
-        '''b<n>     Set FA id <n> for playback'''
-        bpm = int(arg)
-        assert 0 <= bpm <= 255
-        self.set_bpm(bpm)
+        '''b<ids>   Set FA ids for playback, eg b4 or b1-10,12'''
+        bpms = falib.parse_mask(arg)
+        assert bpms and 0 <= bpms[0] and bpms[-1] < self.server.fa_id_count
+        self.set_bpms(bpms)
 
     def command_v(self, arg):
         '''v<n>     Set volume to <n>dB.  Default volume is 0dB'''
-        self.volume = float(arg)
+        self.audio.volume = float(arg)
 
     def command_x(self, arg):
         '''x        Only play X channel'''
-        self.channels = 'l'
+        self.audio.channels = 'l'
     def command_y(self, arg):
         '''y        Only play Y channel'''
-        self.channels = 'r'
+        self.audio.channels = 'r'
     def command_a(self, arg):
         '''a        Play X channel in left speaker, Y channel in right'''
-        self.channels = 'b'
+        self.audio.channels = 'b'
+
+    def command_s(self, arg):
+        '''s<l,h,f> Shift <l> to <h>Hz up by <f>Hz, s alone to play unshifted'''
+        if arg.strip():
+            self.audio.set_shift(*shift.parse_band(arg))
+        else:
+            self.audio.set_shift(None, None, None)
 
     def command_i(self, arg):
         '''i        Show information about current settings'''
-        print(f'BPM {self.sub.bpm}')
-        print(f'Volume {self.volume} dB')
-        print(f'Channel {self.channels}')
-        print(f'Max volume: {numpy.min(self.mvolume):.1f} dB')
+        print(f'BPM {falib.falib.format_mask(self.audio.selected)[1]}')
+        print(f'Volume {self.audio.volume} dB')
+        print(f'Channel {self.audio.channels}')
+        shifter = self.audio.shifter
+        if shifter:
+            print(f'Shifting {shifter.low:g}-{shifter.high:g} Hz '
+                f'up by {shifter.shift:g} Hz')
+        print(f'Max volume: {numpy.min(self.audio.mvolume):.1f} dB')
+        print(f'Latency {self.latency():.3f} s, rate {self.rate} Hz, '
+            f'ratio {self.audio.resampler.ratio:.5f}, overruns {self.overruns}')
 
-    commands = 'hqbvxyai'
+    commands = 'hqbvxyasi'
 
 
     def get_command(self, command):
@@ -206,16 +274,89 @@ class Player:
                     print('Unknown command.  Possible commands are:')
                     self.command_h(arg)
 
+def render(server, bpms, band, pans):
+    '''Renders archived data to a WAV file as fast as we can.'''
+    f_s = server.sample_frequency / decimation
+
+    # Playing faster than real time is just resampling by a larger ratio.
+    audio = pipeline.audio_pipeline(
+        f_s, options.speed * f_s / options.rate, options.volume, pans,
+        BLOCK_SIZE)
+    audio.selected = bpms
+    audio.channels = channels
+    if band:
+        audio.set_shift(*band)
+
+    reader = server.archive(bpms, start, end = end,
+        source = options.format, fields = 1, all_data = True)
+    output = wave.open(options.output, 'wb')
+    output.setnchannels(2)
+    output.setsampwidth(4)
+    output.setframerate(options.rate)
+    rendered = 0
+    # Samples left over from the previous archive block: the pipeline removes
+    # the mean and sets the gain of each block, so every block but the last is
+    # given exactly BLOCK_SIZE samples.
+    leftover = None
+    try:
+        for _, _, _, data in reader:
+            rendered += len(data)
+            if reader.decimated:
+                # Only the mean is fetched
+                data = data[:, :, 0, :]
+            if leftover is not None:
+                data = numpy.concatenate((leftover, data))
+            whole = len(data) - len(data) % BLOCK_SIZE
+            for n in range(0, whole, BLOCK_SIZE):
+                output.writeframes(audio.process(
+                    bpms, data[n:n + BLOCK_SIZE]).tobytes())
+            leftover = data[whole:]
+            sys.stderr.write('%d of %d samples\r' % (rendered, reader.samples))
+        if leftover is not None and len(leftover):
+            output.writeframes(audio.process(bpms, leftover).tobytes())
+    finally:
+        sys.stderr.write('\n')
+        reader.close()
+        output.close()
+
+
 parser = optparse.OptionParser(usage = '''\
 fa-audio [options] [location]
 
-Plays back FA data stream as audio through the PC speakers.''')
+Plays back FA data stream as audio through the PC speakers, or with -o renders
+archived data to a WAV file.''')
 parser.add_option(
     '-v', dest = 'volume', default = 0, type = 'float',
     help = 'Set initial volume in dB, default is 0dB')
 parser.add_option(
-    '-b', dest = 'bpm_id', default = 1, type = 'int',
-    help = 'Choose initial FA id for playback, default is 1')
+    '-b', dest = 'bpm_ids', default = '1',
+    help = 'Choose initial FA ids for playback, default is 1')
+parser.add_option(
+    '-m', dest = 'subscribe', default = None,
+    help = 'FA ids to subscribe to for mixing, default is all BPMs in the '
+        'location file')
+parser.add_option(
+    '-s', dest = 'band', default = None, type = 'string',
+    help = 'Shift band low,high up by shift Hz, given as low,high,shift')
+parser.add_option(
+    '-c', dest = 'channels', default = 'a',
+    help = 'Play X (x), Y (y) or both (a) channels, default is a')
+parser.add_option(
+    '-r', dest = 'rate', default = 10000, type = 'int',
+    help = 'Audio sample rate, default is 10000Hz')
+parser.add_option(
+    '-o', dest = 'output', default = None,
+    help = 'Render archived data to the given WAV file instead of playing')
+parser.add_option(
+    '-T', dest = 'times', default = None,
+    help = 'Time range to render, yyyy-mm-ddThh:mm:ss[.us][Z]~... or '
+        'hh:mm:ss[Y]~... for today or yesterday')
+parser.add_option(
+    '-F', dest = 'format', default = 'F',
+    help = 'Archive data to render: F (default), D or DD')
+parser.add_option(
+    '-x', dest = 'speed', default = 1, type = 'float',
+    help = 'Speed up rendered data by this factor, default is 1')
 parser.add_option(
     '-f', dest = 'full_path', default = False, action = 'store_true',
     help = 'Location is full path to location file')
@@ -235,8 +376,79 @@ falib.load_location_file(
     globals(), location, options.full_path, options.server)
 
 
-server = falib.Server(server = FA_SERVER, port = FA_PORT)
-player = Player(options.bpm_id, server, options.volume)
+try:
+    bpm_ids = falib.parse_mask(options.bpm_ids)
+    subscribe = falib.parse_mask(options.subscribe) if options.subscribe else []
+except ValueError:
+    parser.error('Invalid FA id list')
+
+if options.band:
+    try:
+        band = shift.parse_band(options.band)
+    except ValueError as error:
+        parser.error('Invalid band specification: %s' % error)
+else:
+    band = None
+
+try:
+    channels = {'x': 'l', 'y': 'r', 'a': 'b'}[options.channels]
+except KeyError:
+    parser.error('Invalid channel selection')
+
+if options.output:
+    if options.times is None:
+        parser.error('Must specify time range to render with -T')
+    if options.format not in ['F', 'D', 'DD']:
+        parser.error('Invalid data format')
+    try:
+        start, end = falib.parse_time_range(
+            's' if 'T' in options.times else 't', options.times)
+        if end is None:
+            raise ValueError('Must specify a range of times')
+    except ValueError as error:
+        parser.error(str(error))
+elif options.times:
+    parser.error('Time range only for rendering with -o')
+
+
+server = falib.Server(server = FA_SERVER, port = FA_PORT, virtual = VIRTUAL)
+
+# Rendering from decimated data runs the pipeline at the decimated rate.
+if options.output and options.format != 'F':
+    d, dd = server.get_archive_decimations()
+    decimation = d if options.format == 'D' else dd
+else:
+    decimation = 1
+if options.output and \
+        options.speed * server.sample_frequency / decimation * MAX_UPSAMPLE < \
+        options.rate:
+    parser.error('Data at %g Hz is too slow to render at %d Hz, '
+        'speed it up with -x' % (
+            server.sample_frequency / decimation, options.rate))
+if band:
+    try:
+        shift.check_band(server.sample_frequency / decimation, *band)
+    except ValueError as error:
+        parser.error('Invalid band specification: %s' % error)
+
+# Pan each BPM by its position around the ring, if the location file tells us
+# how to work this out.
+if 'MAKE_ID_FN' in globals():
+    pans = mix.ring_pans(server.get_fa_ids(), MAKE_ID_PATTERN, MAKE_ID_FN)
+else:
+    pans = {}
+if options.subscribe is None:
+    subscribe = list(pans)
 
 def main():
-    player.shell()
+    if options.output:
+        try:
+            render(server, bpm_ids, band, pans)
+        except Exception as error:
+            print('Unable to render audio: %s' % error, file = sys.stderr)
+            sys.exit(1)
+    else:
+        player = Player(bpm_ids, server, options.volume, options.rate, band,
+            subscribe, pans)
+        player.audio.channels = channels
+        player.shell()
@@ -0,0 +1,110 @@
+#   Multiple BPM Mixing
+#
+# Several FA ids can be played at once, each panned across the stereo field by
+# its position around the ring so that the listener can hear where a
+# disturbance is coming from.  The subscription covers a fixed set of ids and
+# the mixer reduces each block to two audio channels with a single matrix
+# multiply, so changing the selection only means recomputing the gain matrix.
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+import re
+import numpy
+
+
+def ring_pans(fa_ids, pattern, make_id):
+    '''Computes a pan position for each BPM from its position around the ring.
+    fa_ids is a list of (fa_id, name) pairs, and the position of each BPM is
+    computed by matching its name against pattern and passing the matched
+    groups to make_id, as for MAKE_ID_PATTERN and MAKE_ID_FN in the location
+    file.  Returns a dictionary mapping FA id to a pan position from 0 (left)
+    to 1 (right).'''
+    positions = {}
+    for fa_id, name in fa_ids:
+        match = re.match(pattern, name)
+        if match:
+            positions[fa_id] = make_id(*match.groups())
+    if not positions:
+        return {}
+    low = min(positions.values())
+    high = max(positions.values())
+    span = high - low or 1
+    return dict(
+        (fa_id, (position - low) / span)
+        for fa_id, position in positions.items())
+
+
+class mixer:
+    '''m = mixer(pans, max_block)
+
+    Mixes blocks of FA data indexed by sample, id and X/Y into stereo audio.
+    pans maps FA id to pan position as returned by ring_pans(), ids without a
+    position are placed in the centre.'''
+
+    def __init__(self, pans, max_block):
+        self.pans = pans
+        self.max_block = max_block
+        self.key = None
+        self.gains = None
+        self.output = numpy.empty((max_block, 2), numpy.float32)
+        self.input = None
+
+    def configure(self, ids, selected, channels):
+        '''Computes the gain matrix for mixing the selected ids from blocks
+        containing the given list of ids.  With a single id selected channels
+        is 'b' to play X left and Y right, or 'l' or 'r' to play just X or Y
+        in both speakers.  With several ids selected each id is panned by its
+        ring position and channels selects X, Y or both.'''
+        gains = numpy.zeros((len(ids), 2, 2), numpy.float32)
+        columns = [ids.index(id) for id in selected]
+        if len(columns) == 1:
+            column = columns[0]
+            if channels == 'l':
+                gains[column, 0, :] = 1
+            elif channels == 'r':
+                gains[column, 1, :] = 1
+            else:
+                gains[column, 0, 0] = 1
+                gains[column, 1, 1] = 1
+        else:
+            planes = {'l': [1, 0], 'r': [0, 1], 'b': [1, 1]}[channels]
+            # Constant power panning, and scale for constant loudness as the
+            # number of mixed (mostly uncorrelated) BPMs changes.
+            scale = 1 / numpy.sqrt(len(columns) * sum(planes))
+            for id, column in zip(selected, columns):
+                angle = self.pans.get(id, 0.5) * numpy.pi / 2
+                pan = numpy.array([numpy.cos(angle), numpy.sin(angle)])
+                gains[column] = scale * numpy.outer(planes, pan)
+        self.gains = gains.reshape(-1, 2)
+
+        if self.input is None or self.input.shape[1] != 2 * len(ids):
+            self.input = numpy.empty(
+                (self.max_block, 2 * len(ids)), numpy.float32)
+        self.key = (ids, selected, channels)
+
+    def mix(self, ids, selected, channels, block):
+        '''Mixes a block of data containing the given ids, returning a view
+        of the stereo output which is valid until the next call.'''
+        key = (tuple(ids), tuple(selected), channels)
+        if key != self.key:
+            self.configure(*key)
+        length = len(block)
+        input = self.input[:length]
+        input[:] = block.reshape(length, -1)
+        output = self.output[:length]
+        numpy.dot(input, self.gains, out = output)
+        return output
@@ -0,0 +1,112 @@
+#   Audio Pipeline
+#
+# The processing shared by live playback and offline rendering: blocks of FA
+# data are mixed down to stereo, optionally frequency shifted, rescaled to
+# avoid clipping and finally resampled to the audio rate and converted to
+# 32-bit samples.
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+import numpy
+
+from fa.audio import resample
+from fa.audio import shift
+from fa.audio import mix
+
+
+# Offset applied to user programmed volume, in dB.
+volume_offset = 50
+
+# Largest float32 value that converts to int32 without overflow.
+MAX_SAMPLE = 2**31 - 128
+
+
+class audio_pipeline:
+    '''p = audio_pipeline(f_s, ratio, volume, pans, max_block)
+
+    Converts blocks of FA data sampled at f_s into stereo audio, resampling by
+    the given ratio of input to output samples.  The selected ids, channel
+    selection and volume can be changed between blocks by assigning to
+    p.selected, p.channels and p.volume.'''
+
+    def __init__(self, f_s, ratio, volume, pans, max_block):
+        self.f_s = f_s
+        self.max_block = max_block
+        self.volume = volume
+        self.channels = 'b'
+        self.selected = []
+        self.shifter = None
+
+        self.mixer = mix.mixer(pans, max_block)
+        self.resampler = resample.resampler(2, ratio, max_block)
+        self.scaled = numpy.empty((max_block, 2), numpy.float32)
+        self.pcm = numpy.empty((self.resampler.max_output, 2), numpy.int32)
+
+        # Hang onto input volume level history for last 5 seconds.
+        self.mvolume = 100 * numpy.ones(50)
+
+    def reset_volume(self):
+        self.mvolume[:] = 100
+
+    def set_shift(self, low, high, shift_by):
+        '''Selects frequency shifting of the given band, or direct playback if
+        shift_by is None.'''
+        if shift_by is None:
+            self.shifter = None
+        else:
+            self.shifter = shift.heterodyne(
+                self.f_s, low, high, shift_by, 2, self.max_block)
+        # Reset volume history as the level will change
+        self.reset_volume()
+
+
+    # Rescales audio to avoid clipping after volume scaling.
+    def rescale(self, data):
+        # First remove any DC component as this makes no sense for sound
+        block = self.scaled[:len(data)]
+        block[:] = data
+        block -= block.mean(axis = 0)
+
+        # Compute the available dynamic range
+        range = max(block.max(), -block.min())
+        vscale = 10 ** ((self.volume + volume_offset) / 20.)
+        mscale = (2**31 - 1.) / range
+        block *= min(vscale, mscale)
+
+        # Convert mscale into a measure of raw volume
+        mvol = 20 * numpy.log10(mscale) - volume_offset
+        self.mvolume[1:] = self.mvolume[:-1]
+        self.mvolume[0] = mvol
+
+        return block
+
+
+    def process(self, ids, block):
+        '''Processes a block of data indexed by sample, id and X/Y for the
+        given list of ids, returns a view of the resulting audio samples which
+        is valid until the next call.'''
+        block = self.mixer.mix(ids, self.selected, self.channels, block)
+        shifter = self.shifter
+        if shifter:
+            block = shifter.process(block)
+        output = self.resampler.process(self.rescale(block))
+
+        # The resampling filter can overshoot slightly.
+        numpy.clip(output, -MAX_SAMPLE, MAX_SAMPLE, out = output)
+        pcm = self.pcm[:len(output)]
+        numpy.copyto(pcm, output, casting = 'unsafe')
+        return pcm
@@ -0,0 +1,205 @@
+#   Audio Resampling
+#
+# The FA data rate (around 10072 Hz at Diamond) is unrelated to any audio
+# rate, and in any case the two clocks drift relative to each other.  Rather
+# than dropping blocks of data when we get ahead, which produces audible clicks,
+# the data is passed through a polyphase resampler whose ratio is continuously
+# trimmed by a rate controller watching how much data is waiting to be played.
+# The resampled audio is then held in a fixed size ring buffer until the audio
+# device is ready for it.
+#
+# All buffers are allocated up front for the largest block we expect, so no
+# sample buffers are allocated while streaming.
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+import numpy
+
+
+class resampler:
+    '''r = resampler(channels, ratio, max_input)
+
+    Streaming polyphase resampler.  The ratio is the number of input samples
+    consumed for each output sample and can be changed between blocks.  Blocks
+    of at most max_input samples are passed to r.process() which returns the
+    corresponding output samples.
+
+    Each output sample is computed from taps input samples using the nearest
+    of phases precomputed Kaiser windowed sinc filters, with the cutoff set to
+    cutoff times the lower of the two Nyquist frequencies.  When decimating
+    the filter is lengthened by the ratio, so that its main lobe still fits
+    within the window.'''
+
+    def __init__(self, channels, ratio, max_input,
+            taps = 16, phases = 1024, cutoff = 0.9, max_ratio_change = 0.05):
+        self.ratio = ratio
+        # Lowering the cutoff by the ratio widens the sinc by the same factor.
+        taps = taps * int(numpy.ceil(max(ratio, 1.0)))
+        self.taps = taps
+        self.phases = phases
+        self.max_input = max_input
+
+        # Filter table: row p is the filter for an output sample p/phases of an
+        # input sample after the centre tap, with each row normalised for unit
+        # DC gain.
+        bandwidth = cutoff * min(1.0, 1.0 / ratio)
+        offsets = numpy.arange(taps) - (taps // 2 - 1)
+        t = offsets[None, :] - numpy.arange(phases + 1)[:, None] / phases
+        table = bandwidth * numpy.sinc(bandwidth * t) * \
+            numpy.kaiser(taps + 2, 8)[1:-1][None, :]
+        table /= table.sum(axis = 1)[:, None]
+        self.table = numpy.float32(table)
+
+        # History of input samples.  Up to two filters' worth of samples are
+        # carried over from the previous block.
+        self.history = numpy.zeros(
+            (2 * taps + max_input, channels), numpy.float32)
+        self.fill = taps
+        self.position = float(taps // 2)
+
+        # Work areas sized for the largest possible output block.
+        max_output = int(max_input / (ratio * (1 - max_ratio_change))) + 2
+        self.max_output = max_output
+        self.steps = numpy.arange(max_output, dtype = numpy.float64)
+        self.positions = numpy.empty(max_output, numpy.float64)
+        self.fraction = numpy.empty(max_output, numpy.float64)
+        self.index = numpy.empty(max_output, numpy.intp)
+        self.phase = numpy.empty(max_output, numpy.intp)
+        self.gather_index = numpy.empty((max_output, taps), numpy.intp)
+        self.gather = numpy.empty((max_output, taps, channels), numpy.float32)
+        self.coefficients = numpy.empty((max_output, taps), numpy.float32)
+        self.offsets = offsets
+        self.output = numpy.empty((max_output, channels), numpy.float32)
+
+    def process(self, block):
+        '''Resamples the given block, returns a view of the output samples.  The
+        result is only valid until the next call.'''
+        taps = self.taps
+        length = len(block)
+        assert length <= self.max_input and \
+            self.fill + length <= len(self.history), \
+            'Block too large for resampler'
+        self.history[self.fill:self.fill + length] = block
+        self.fill += length
+
+        # Compute the input positions of all the output samples we can now
+        # generate: each output needs taps // 2 samples beyond its position.
+        limit = self.fill - taps // 2
+        count = int(numpy.ceil((limit - self.position) / self.ratio))
+        count = min(max(count, 0), self.max_output)
+        positions = self.positions[:count]
+        numpy.multiply(self.steps[:count], self.ratio, out = positions)
+        positions += self.position
+
+        # Split each position into the index of its centre tap and the
+        # nearest filter phase.
+        fraction = self.fraction[:count]
+        numpy.floor(positions, out = fraction)
+        index = self.index[:count]
+        index[:] = fraction
+        numpy.subtract(positions, fraction, out = fraction)
+        fraction *= self.phases
+        numpy.rint(fraction, out = fraction)
+        phase = self.phase[:count]
+        phase[:] = fraction
+
+        # Gather the input samples for each output and apply the filter.
+        gather_index = self.gather_index[:count]
+        numpy.add(index[:, None], self.offsets, out = gather_index)
+        gather = self.gather[:count]
+        numpy.take(self.history, gather_index, axis = 0, out = gather)
+        coefficients = self.coefficients[:count]
+        numpy.take(self.table, phase, axis = 0, out = coefficients)
+        gather *= coefficients[:, :, None]
+        output = self.output[:count]
+        numpy.sum(gather, axis = 1, out = output)
+
+        # Discard input we no longer need, keeping the tail for the filter.
+        next_position = self.position + count * self.ratio
+        discard = min(int(next_position) - taps, self.fill - taps)
+        if discard > 0:
+            self.history[:self.fill - discard] = \
+                self.history[discard:self.fill]
+            self.fill -= discard
+            next_position -= discard
+        self.position = next_position
+        return output
+
+
+class rate_controller:
+    '''c = rate_controller(nominal, target)
+
+    Proportional and integral control of the resampling ratio to hold the
+    amount of data waiting to be played (measured in seconds) close to target.
+    If data backs up the ratio is increased so that input is consumed faster,
+    and vice versa.  The correction is limited to +-limit of nominal.'''
+
+    def __init__(self, nominal, target, kp = 0.005, ki = 0.0005, limit = 0.01):
+        self.nominal = nominal
+        self.target = target
+        self.kp = kp
+        self.ki = ki
+        self.limit = limit
+        self.integral = 0
+
+    def update(self, level):
+        '''Updates the controller with the current backlog, returns the ratio
+        to use for the next block.'''
+        error = (level - self.target) / self.target
+        self.integral = min(max(
+            self.integral + self.ki * error, -self.limit), self.limit)
+        correction = min(max(
+            self.kp * error + self.integral, -self.limit), self.limit)
+        return self.nominal * (1 + correction)
+
+
+class ring_buffer:
+    '''Fixed size byte ring buffer used to hold audio waiting to be written to
+    the audio device.  Data is written as numpy arrays and read back as
+    contiguous memoryviews suitable for os.write().'''
+
+    def __init__(self, size):
+        self.buffer = numpy.zeros(size, numpy.uint8)
+        self.view = memoryview(self.buffer)
+        self.size = size
+        self.head = 0           # Next byte to write
+        self.level = 0          # Number of bytes buffered
+
+    def write(self, data):
+        '''Writes the given array into the buffer, returns the number of bytes
+        discarded if the buffer overflowed.'''
+        data = data.reshape(-1).view(numpy.uint8)
+        length = len(data)
+        overflow = max(0, length - (self.size - self.level))
+        length -= overflow
+        first = min(length, self.size - self.head)
+        self.buffer[self.head:self.head + first] = data[:first]
+        self.buffer[:length - first] = data[first:length]
+        self.head = (self.head + length) % self.size
+        self.level += length
+        return overflow
+
+    def readable(self):
+        '''Returns a view of the oldest contiguous data in the buffer.'''
+        tail = (self.head - self.level) % self.size
+        return self.view[tail:tail + min(self.level, self.size - tail)]
+
+    def consume(self, length):
+        self.level -= length
+
+    def reset(self):
+        self.level = 0
@@ -0,0 +1,103 @@
+#   Frequency Shifting
+#
+# Most beam motion of interest is well below 100Hz where it is barely audible,
+# so a selected band can be moved up into the audible range by single sideband
+# frequency shifting using the Weaver method: the band is mixed down to zero
+# frequency with a complex oscillator at its centre, low pass filtered to half
+# its width to remove everything outside the band, and then mixed back up with
+# an oscillator at the centre plus the requested shift.  Taking the real part
+# leaves the band moved up by the shift frequency with its spectrum the right
+# way up and no mirror image.
+#
+# Filter state and oscillator phases are carried from block to block so that
+# there are no discontinuities at block boundaries.
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+import numpy
+from scipy import signal
+
+
+def parse_band(arg):
+    '''Parses a band specification of the form low,high,shift in Hz.'''
+    low, high, shift = map(float, arg.split(','))
+    if not 0 <= low < high:
+        raise ValueError('Invalid frequency band')
+    return low, high, shift
+
+def check_band(f_s, low, high, shift):
+    '''Raises ValueError unless the band can be shifted at sample frequency
+    f_s.'''
+    if not 0 <= low < high:
+        raise ValueError('Invalid frequency band')
+    if high + shift >= f_s / 2:
+        raise ValueError('Shifted band must be below %g Hz' % (f_s / 2))
+
+
+class heterodyne:
+    '''h = heterodyne(f_s, low, high, shift, channels, max_block)
+
+    Streaming single sideband frequency shifter.  Frequencies in the band low
+    to high Hz are moved up by shift Hz, all other frequencies are removed.
+    Blocks of up to max_block samples indexed by sample and channel are passed
+    to h.process() which returns the shifted block.'''
+
+    def __init__(self, f_s, low, high, shift, channels, max_block,
+            order = 8):
+        check_band(f_s, low, high, shift)
+        self.low = low
+        self.high = high
+        self.shift = shift
+
+        centre = (low + high) / 2
+        self.sos = signal.butter(
+            order, (high - low) / 2, fs = f_s, output = 'sos')
+        self.zi = numpy.zeros(
+            (len(self.sos), 2, channels), dtype = numpy.complex128)
+
+        # Oscillator phase advance per sample for mixing down and up, and
+        # current phases in radians.
+        self.step_down = -2 * numpy.pi * centre / f_s
+        self.step_up = 2 * numpy.pi * (centre + shift) / f_s
+        self.phase_down = 0.
+        self.phase_up = 0.
+
+        self.steps = numpy.arange(max_block, dtype = numpy.float64)
+        self.oscillator = numpy.empty(max_block, numpy.complex128)
+        self.output = numpy.empty((max_block, channels), numpy.float32)
+
+    def __mix(self, block, phase, step):
+        '''Multiplies block by a complex oscillator starting at phase and
+        returns the phase at the end of the block.'''
+        length = len(block)
+        oscillator = self.oscillator[:length]
+        numpy.multiply(self.steps[:length], 1j * step, out = oscillator)
+        oscillator += 1j * phase
+        numpy.exp(oscillator, out = oscillator)
+        block *= oscillator[:, None]
+        return (phase + length * step) % (2 * numpy.pi)
+
+    def process(self, block):
+        '''Shifts the given block, returns a view of the shifted data which is
+        only valid until the next call.'''
+        mixed = numpy.array(block, dtype = numpy.complex128)
+        self.phase_down = self.__mix(mixed, self.phase_down, self.step_down)
+        mixed, self.zi = signal.sosfilt(self.sos, mixed, axis = 0, zi = self.zi)
+        self.phase_up = self.__mix(mixed, self.phase_up, self.step_up)
+        output = self.output[:len(block)]
+        numpy.multiply(mixed.real, 2, out = output, casting = 'unsafe')
+        return output
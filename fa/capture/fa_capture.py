@@ -0,0 +1,257 @@
+# Captures data from the FA archiver to disk
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Python implementation of fa-capture(1), streaming data from a subscription or
+# from the archive straight to disk.  Data is written block by block as it
+# arrives, so arbitrarily long continuous captures run in bounded memory, and
+# gaps in the data stream are recorded with the capture rather than failing it
+# unless -c is specified.
+
+import sys
+import optparse
+
+from fa import falib
+from fa.capture import writers
+from fa.capture import compressed
+
+
+def parse_format(format):
+    '''Parses the -f data format, returns (source, fields).'''
+    source = {'F': 'F', 'd': 'D', 'D': 'DD'}.get(format[:1])
+    if source is None:
+        raise ValueError('Invalid data format %s' % format)
+    if format[1:]:
+        if source == 'F':
+            raise ValueError('No mask allowed for full rate data')
+        fields = int(format[1:])
+        if not 0 < fields <= 15:
+            raise ValueError('Invalid decimated data mask %d' % fields)
+    else:
+        fields = 15
+    return source, fields
+
+
+parser = optparse.OptionParser(usage = '''\
+fa-capture [-o output-file] [-C|-D|start-time] [options] pv-list [samples]
+
+Captures data from the FA archiver, either historical data from the archive, or
+live data from the data stream.  The pv-list is a comma separated list of FA ids
+or ranges of ids, and samples can be followed by s to specify a duration in
+seconds.  The output format is determined by the extension of the output file:
+.mat for Matlab format, .npy for numpy format (with a separate .meta.npz index),
+.h5 for HDF5 or .fac for delta encoded compressed captures.''')
+falib.add_time_options(parser)
+parser.add_option(
+    '-C', dest = 'continuous', default = False, action = 'store_true',
+    help = 'Continuous capture from live data stream')
+parser.add_option(
+    '-D', dest = 'decimated', default = False, action = 'store_true',
+    help = 'Continuous capture of decimated live data')
+parser.add_option(
+    '-o', dest = 'output', default = None,
+    help = 'Save output to specified file, otherwise raw data sent to stdout')
+parser.add_option(
+    '-f', dest = 'format', default = 'F',
+    help = 'Data format: F (default), d[mask] or D[mask] for decimated data')
+parser.add_option(
+    '-a', dest = 'all_data', default = False, action = 'store_true',
+    help = 'Capture all available data even if too much requested')
+parser.add_option(
+    '-R', dest = 'raw', default = False, action = 'store_true',
+    help = 'Save raw sample data with no header or index')
+parser.add_option(
+    '-c', dest = 'contiguous', default = False, action = 'store_true',
+    help = 'Forbid any gaps in the captured data')
+parser.add_option(
+    '-z', dest = 'check_id0', default = False, action = 'store_true',
+    help = 'With -c also check for gaps in id0')
+parser.add_option(
+    '-T', dest = 'id0', default = False, action = 'store_true',
+    help = 'Save id0 with captured block index and matlab id0 array')
+parser.add_option(
+    '-k', dest = 'keep_dims', default = False, action = 'store_true',
+    help = 'Keep extra dimensions in matlab values')
+parser.add_option(
+    '-n', dest = 'name', default = 'data',
+    help = 'Specify name of matlab data array (default is "data")')
+parser.add_option(
+    '-Z', dest = 'utc', default = False, action = 'store_true',
+    help = 'Use UTC timestamps for matlab timestamps')
+parser.add_option(
+    '-d', dest = 'subtract_day', default = False, action = 'store_true',
+    help = 'Subtract day of first timestamp from matlab timestamp vector')
+parser.add_option(
+    '-x', dest = 'codec', default = 'zlib',
+    help = 'Compression for .fac captures: zlib (default) or lzma')
+parser.add_option(
+    '-V', dest = 'virtual', default = None,
+    help = 'Location name or path of location file defining virtual ids')
+parser.add_option(
+    '-S', dest = 'server', default = falib.falib.DEFAULT_SERVER,
+    help = 'Specify archive server to read from')
+parser.add_option(
+    '-p', dest = 'port', default = falib.falib.DEFAULT_PORT, type = 'int',
+    help = 'Specify port to connect to on server')
+parser.add_option(
+    '-q', dest = 'quiet', default = False, action = 'store_true',
+    help = 'Suppress display of capture progress')
+options, args = parser.parse_args()
+
+if options.start is None:
+    if options.continuous == options.decimated:
+        parser.error('Must specify exactly one of -C, -D or a start time')
+elif options.continuous or options.decimated:
+    parser.error('Cannot specify start time with continuous capture')
+if not 1 <= len(args) <= 2:
+    parser.error('Must specify pv-list and optional sample count')
+
+try:
+    fa_ids = falib.parse_mask(args[0])
+    source, fields = parse_format(options.format)
+    if options.codec not in compressed.Compressors:
+        raise ValueError('Unknown codec %s' % options.codec)
+    if options.start is None:
+        start, end = None, None
+        if source != 'F':
+            raise ValueError('Decimated data format only for archived data')
+    else:
+        start, end = falib.parse_time_range(*options.start)
+        if (end is None) == (len(args) == 1):
+            raise ValueError(
+                'Must specify exactly one of samples or time range')
+except ValueError as error:
+    parser.error(str(error))
+
+# Virtual ids are captured like real ids, if they are defined.
+virtual = []
+if options.virtual:
+    location = {}
+    falib.load_location_file(
+        location, options.virtual, '/' in options.virtual)
+    virtual = location['VIRTUAL']
+
+
+def open_source(server):
+    '''Opens the requested data source, returns (reader, decimation, samples)
+    where samples is the number of samples that will be delivered if known.'''
+    if start is None:
+        if options.decimated:
+            decimation = server.decimation
+        else:
+            decimation = 1
+        samples = None
+        if len(args) > 1:
+            samples = falib.parse_samples(
+                args[1], server.sample_frequency / decimation)
+        reader = server.subscription(fa_ids,
+            decimated = options.decimated, extended = True,
+            id0 = options.id0 or options.check_id0)
+    else:
+        if source == 'F':
+            decimation = 1
+        else:
+            d, dd = server.get_archive_decimations()
+            decimation = d if source == 'D' else dd
+        kargs = {}
+        if end is None:
+            kargs['samples'] = falib.parse_samples(
+                args[1], server.sample_frequency / decimation)
+        else:
+            kargs['end'] = end
+        reader = server.archive(fa_ids, start, source = source,
+            fields = fields, id0 = options.id0 or options.check_id0,
+            all_data = options.all_data, contiguous = options.contiguous,
+            check_id0 = options.check_id0, **kargs)
+        samples = reader.samples
+    return reader, decimation, samples
+
+
+def capture(reader, writer, checker, samples):
+    '''Copies data from reader to writer until samples have been captured or
+    the reader is exhausted.'''
+    captured = 0
+    offset = reader.offset
+    while samples is None or captured < samples:
+        block = reader.read_extended()
+        if block is None:
+            break
+        timestamp, duration, id0, data = block
+
+        gap = checker.check(timestamp, duration, id0)
+        if gap and options.contiguous:
+            raise falib.connection.Error(
+                'Gap in data after %d samples' % gap.sample)
+        if samples is not None:
+            data = data[:samples - captured]
+        writer.write(timestamp, duration, id0, data, offset)
+        offset = 0
+
+        captured += len(data)
+        if not options.quiet:
+            sys.stderr.write('%d samples\r' % captured)
+
+
+def main():
+    try:
+        server = falib.Server(
+            server = options.server, port = options.port, virtual = virtual)
+        reader, decimation, samples = open_source(server)
+    except Exception as error:
+        print('Unable to start capture: %s' % error, file = sys.stderr)
+        sys.exit(1)
+
+    if source == 'F':
+        shape = (reader.count, 2)
+        field_mask = 0
+    else:
+        shape = (reader.count, bin(fields).count('1'), 2)
+        field_mask = fields
+    info = dict(
+        ids = fa_ids, f_s = server.sample_frequency / decimation,
+        decimation = decimation, block_size = reader.block_size,
+        fields = field_mask)
+    try:
+        writer = writers.open_writer(
+            options.output, options.raw, shape, samples, info,
+            name = options.name, keep_dims = options.keep_dims,
+            utc = options.utc, subtract_day = options.subtract_day,
+            save_id0 = options.id0, codec = options.codec)
+    except ValueError as error:
+        parser.error(str(error))
+
+    checker = falib.continuity(
+        reader.block_size, reader.offset, options.check_id0)
+    status = 0
+    try:
+        capture(reader, writer, checker, samples)
+    except KeyboardInterrupt:
+        pass
+    except Exception as error:
+        print('\nCapture stopped: %s' % error, file = sys.stderr)
+        status = 1
+    finally:
+        reader.close()
+        writer.close(checker.gap_array())
+
+    if not options.quiet:
+        sys.stderr.write('\n')
+        for gap in checker.gaps:
+            print('Gap at sample %d: %d turns, %.6f s' % (
+                gap.sample, gap.turns or 0, 1e-6 * (gap.end - gap.start)),
+                file = sys.stderr)
+    sys.exit(status)
@@ -0,0 +1,221 @@
+# Triggered capture of live data
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Runs a falib.snapshot_capture on a live full rate subscription.  Snapshots are
+# written to disk by a separate thread, so that reading the subscription never
+# waits for the disk and no data is lost while a snapshot is being saved.
+
+import os
+import sys
+import queue
+import optparse
+import datetime
+import threading
+import numpy
+
+from fa import falib
+from fa.capture import writers
+
+
+parser = optparse.OptionParser(usage = '''\
+fa-trigger [options] directory pv-list
+
+Continuously monitors live full rate data for the given ids and saves a capture
+of the data around each trigger in the given directory.  The trigger fires on
+positions beyond limits, on changes between samples beyond a slew limit, or on
+bits in the event mask id.  The pv-list is a comma separated list of FA ids or
+ranges of ids.''')
+parser.add_option(
+    '-T', dest = 'threshold', default = None, type = 'float',
+    help = 'Trigger on movement further than this from the position when '
+        'started, in micrometres')
+parser.add_option(
+    '-l', dest = 'limits', default = None,
+    help = 'File of per id limits, one line per id of: id x-low x-high '
+        'y-low y-high, in micrometres')
+parser.add_option(
+    '-r', dest = 'slew', default = None, type = 'float',
+    help = 'Trigger on a change between samples larger than this, in '
+        'micrometres')
+parser.add_option(
+    '-e', dest = 'mask', default = '0',
+    help = 'Trigger on any of these bits set in the event mask id')
+parser.add_option(
+    '-B', dest = 'before', default = 1, type = 'float',
+    help = 'Seconds captured before each trigger, default 1')
+parser.add_option(
+    '-A', dest = 'after', default = 1, type = 'float',
+    help = 'Seconds captured from each trigger, default 1')
+parser.add_option(
+    '-E', dest = 'extension', default = '.h5',
+    help = 'Capture file extension, default .h5')
+parser.add_option(
+    '-n', dest = 'count', default = None, type = 'int',
+    help = 'Stop after this many captures')
+parser.add_option(
+    '-S', dest = 'server', default = falib.falib.DEFAULT_SERVER,
+    help = 'Specify archive server to read from')
+parser.add_option(
+    '-p', dest = 'port', default = falib.falib.DEFAULT_PORT, type = 'int',
+    help = 'Specify port to connect to on server')
+parser.add_option(
+    '-q', dest = 'quiet', default = False, action = 'store_true',
+    help = 'Suppress display of progress')
+options, args = parser.parse_args()
+
+if len(args) != 2:
+    parser.error('Must specify output directory and pv-list')
+directory = args[0]
+
+try:
+    fa_ids = falib.parse_mask(args[1])
+    mask = int(options.mask, 0)
+    if not 0 <= mask < 2**32:
+        raise ValueError('Event mask must be a 32 bit word')
+    if options.extension.lower() not in writers.Writers:
+        raise ValueError('Unknown capture file extension "%s"' %
+            options.extension)
+    if options.threshold is None and options.limits is None and \
+            options.slew is None and not mask:
+        raise ValueError('Must specify at least one trigger condition')
+except ValueError as error:
+    parser.error(str(error))
+
+
+def log(message):
+    if not options.quiet:
+        print(message, file = sys.stderr)
+
+
+def read_limits(filename, ids, low, high):
+    '''Updates low and high, indexed by id and X/Y, from a limits file.'''
+    for line in open(filename):
+        line = line.split('#')[0].split()
+        if line:
+            id, x_low, x_high, y_low, y_high = line
+            n = ids.index(int(id))
+            low[n] = 1e3 * float(x_low), 1e3 * float(y_low)
+            high[n] = 1e3 * float(x_high), 1e3 * float(y_high)
+
+
+def reference(sub, samples):
+    '''Returns the mean position of the first samples read.'''
+    total = 0
+    count = 0
+    while count < samples:
+        _, _, _, data = sub.read_extended()
+        total = total + numpy.sum(data, axis = 0, dtype = numpy.float64)
+        count += len(data)
+    return total / count
+
+
+class snapshot_writer:
+    '''Writes snapshots to capture files on a thread of its own.'''
+
+    def __init__(self, ids, f_s, block_size):
+        self.ids = ids
+        self.f_s = f_s
+        self.block_size = block_size
+        self.queue = queue.Queue()
+        self.thread = threading.Thread(target = self.run)
+        self.thread.start()
+
+    def put(self, snapshot):
+        self.queue.put(snapshot)
+
+    def close(self):
+        self.queue.put(None)
+        self.thread.join()
+
+    def run(self):
+        while True:
+            snapshot = self.queue.get()
+            if snapshot is None:
+                break
+            try:
+                self.write(snapshot)
+            except Exception as error:
+                log('Unable to save snapshot: %s' % error)
+
+    def write(self, snapshot):
+        filename = os.path.join(directory, 'trigger-%s%s' % (
+            datetime.datetime.fromtimestamp(snapshot.time).strftime(
+                '%Y%m%d-%H%M%S.%f'), options.extension))
+        info = dict(
+            ids = self.ids, f_s = self.f_s, decimation = 1,
+            block_size = self.block_size, fields = 0,
+            trigger = snapshot.time, reason = snapshot.reason)
+        writers.write_blocks(
+            filename, snapshot.blocks, snapshot.offset, info)
+        log('Trigger at %s on %s saved to %s' % (
+            datetime.datetime.fromtimestamp(snapshot.time).isoformat(),
+            snapshot.reason, filename))
+
+
+def main():
+    try:
+        server = falib.Server(server = options.server, port = options.port)
+        ids = sorted(fa_ids)
+        event = None
+        if mask:
+            event = server.get_event_id()
+            if event < 0:
+                raise ValueError('No event mask id configured on server')
+            if event not in ids:
+                ids = sorted(ids + [event])
+        low = numpy.full((len(ids), 2), -numpy.inf)
+        high = numpy.full((len(ids), 2), numpy.inf)
+        if not os.path.isdir(directory):
+            os.makedirs(directory)
+        sub = server.subscription(ids, extended = True, id0 = True)
+        if options.threshold is not None:
+            # Limits are measured from the position over the first second.
+            centre = reference(sub, int(server.sample_frequency))
+            low = centre - 1e3 * options.threshold
+            high = centre + 1e3 * options.threshold
+        if options.limits:
+            read_limits(options.limits, ids, low, high)
+    except Exception as error:
+        print('Unable to start: %s' % error, file = sys.stderr)
+        sys.exit(1)
+
+    slew = None if options.slew is None else 1e3 * options.slew
+    trigger = falib.trigger(ids, low, high, slew, event, mask)
+    writer = snapshot_writer(ids, server.sample_frequency, sub.block_size)
+    captures = [0]
+    def on_snapshot(snapshot):
+        writer.put(snapshot)
+        captures[0] += 1
+    capture = falib.snapshot_capture(trigger, sub.block_size,
+        int(options.before * server.sample_frequency),
+        int(options.after * server.sample_frequency), on_snapshot)
+
+    log('Waiting for triggers')
+    status = 0
+    try:
+        while options.count is None or captures[0] < options.count:
+            capture.add(*sub.read_extended())
+    except KeyboardInterrupt:
+        pass
+    except Exception as error:
+        print('Stopped: %s' % error, file = sys.stderr)
+        status = 1
+    finally:
+        sub.close()
+        writer.close()
+    sys.exit(status)
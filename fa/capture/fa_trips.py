@@ -0,0 +1,204 @@
+# Captures full rate data around beam trips
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Watches the decimated archive for trips with falib.trip_detector, either over
+# a range of history or following the end of the archive, and for each trip
+# reads a window of full rate data for every archived id, in parallel over
+# several connections, into a capture file of its own.  Following the archive
+# end, each window is captured as soon as it is complete in the archive, long
+# before the archive wraps round and overwrites it.
+
+import os
+import sys
+import time
+import optparse
+import datetime
+
+from fa import falib
+from fa.capture import writers
+
+
+parser = optparse.OptionParser(usage = '''\
+fa-trips [options] [-s|-t|-b start~end] directory
+
+Detects beam trips in the decimated archive and saves a capture of full rate
+data for all archived ids around each trip in the given directory.  If a start
+time range is given that range of the archive is searched, otherwise the end of
+the archive is followed until interrupted.  The capture format is determined by
+the file extension, as for fa-capture.''')
+falib.add_time_options(parser)
+parser.add_option(
+    '-f', dest = 'format', default = 'd',
+    help = 'Archive data to search: d (default) for D data or D for DD data')
+parser.add_option(
+    '-T', dest = 'step', default = 100, type = 'float',
+    help = 'Movement within one decimated sample counted as a trip, in '
+        'micrometres, default 100')
+parser.add_option(
+    '-F', dest = 'fraction', default = 0.5, type = 'float',
+    help = 'Fraction of ids which must move for a trip, default 0.5')
+parser.add_option(
+    '-H', dest = 'holdoff', default = 10, type = 'float',
+    help = 'Seconds after a trip during which further trips are ignored, '
+        'default 10')
+parser.add_option(
+    '-B', dest = 'before', default = 2, type = 'float',
+    help = 'Seconds captured before each trip, default 2')
+parser.add_option(
+    '-A', dest = 'after', default = 0.5, type = 'float',
+    help = 'Seconds captured after each trip, default 0.5')
+parser.add_option(
+    '-E', dest = 'extension', default = '.h5',
+    help = 'Capture file extension, default .h5')
+parser.add_option(
+    '-j', dest = 'connections', default = 8, type = 'int',
+    help = 'Number of concurrent connections for each capture, default 8')
+parser.add_option(
+    '-i', dest = 'interval', default = 5, type = 'float',
+    help = 'Interval between polls of the archive end in seconds, default 5')
+parser.add_option(
+    '-S', dest = 'server', default = falib.falib.DEFAULT_SERVER,
+    help = 'Specify archive server to read from')
+parser.add_option(
+    '-p', dest = 'port', default = falib.falib.DEFAULT_PORT, type = 'int',
+    help = 'Specify port to connect to on server')
+parser.add_option(
+    '-q', dest = 'quiet', default = False, action = 'store_true',
+    help = 'Suppress display of progress')
+options, args = parser.parse_args()
+
+if len(args) != 1:
+    parser.error('Must specify output directory')
+directory = args[0]
+
+try:
+    if options.start is None:
+        start, end = None, None
+    else:
+        start, end = falib.parse_time_range(*options.start)
+        if end is None:
+            raise ValueError('Must specify a range of times')
+    source = {'d': 'D', 'D': 'DD'}.get(options.format)
+    if source is None:
+        raise ValueError('Invalid data format %s' % options.format)
+    if options.extension.lower() not in writers.Writers:
+        raise ValueError('Unknown capture file extension "%s"' %
+            options.extension)
+except ValueError as error:
+    parser.error(str(error))
+
+
+def log(message):
+    if not options.quiet:
+        print(message, file = sys.stderr)
+
+
+class trip_capture:
+    def __init__(self, server):
+        self.server = server
+        self.ids = server.get_archived_ids()
+        self.detector = falib.trip_detector(
+            1e3 * options.step, options.fraction, options.holdoff)
+        d, dd = server.get_archive_decimations()
+        self.dd_interval = dd / server.sample_frequency
+        self.interval = (d if source == 'D' else dd) / server.sample_frequency
+
+    def search(self, start, end):
+        '''Returns the times of any trips from start to end.'''
+        trips = []
+        for times, data in falib.read_blocks(
+                self.server, self.ids, start, end, source, 7):
+            trips.extend(self.detector.update(times, data))
+            # Resume after the last sample read; half a sample interval keeps
+            # clear of rounding in the sample times.
+            self.last = times[-1] + self.interval / 2
+        return trips
+
+    def refine(self, trip):
+        '''Finds a trip detected in DD data in the D data.'''
+        if source == 'DD':
+            detector = falib.trip_detector(
+                1e3 * options.step, options.fraction, options.holdoff)
+            for times, data in falib.read_blocks(self.server, self.ids,
+                    trip - self.dd_interval, trip + 2 * self.dd_interval,
+                    'D', 7):
+                found = detector.update(times, data)
+                if found:
+                    return found[0]
+        return trip
+
+    def save(self, trip):
+        trip = self.refine(trip)
+        offset, block_size, blocks = falib.fetch_parallel(
+            self.server, self.ids,
+            trip - options.before, trip + options.after, options.connections,
+            source = 'F', id0 = True, all_data = True)
+        filename = os.path.join(directory, 'trip-%s%s' % (
+            datetime.datetime.fromtimestamp(trip).strftime(
+                '%Y%m%d-%H%M%S.%f'), options.extension))
+        info = dict(
+            ids = self.ids, f_s = self.server.sample_frequency,
+            decimation = 1, block_size = block_size, fields = 0, trip = trip)
+        writers.write_blocks(filename, blocks, offset, info)
+        log('Trip at %s saved to %s' % (
+            datetime.datetime.fromtimestamp(trip).isoformat(), filename))
+
+    def save_all(self, trips):
+        for trip in trips:
+            try:
+                self.save(trip)
+            except Exception as error:
+                log('Unable to capture trip at %s: %s' % (
+                    datetime.datetime.fromtimestamp(trip).isoformat(), error))
+
+    def follow(self):
+        '''Follows the end of the archive, capturing each trip as soon as its
+        window is in the archive.'''
+        _, self.last = self.server.get_archive_range()
+        pending = []
+        while True:
+            _, archive_end = self.server.get_archive_range()
+            if archive_end > self.last:
+                pending.extend(self.search(self.last, archive_end))
+            ready = [trip for trip in pending
+                if trip + options.after <= archive_end]
+            pending = pending[len(ready):]
+            self.save_all(ready)
+            time.sleep(options.interval)
+
+
+def main():
+    try:
+        server = falib.Server(server = options.server, port = options.port)
+        capture = trip_capture(server)
+        if not os.path.isdir(directory):
+            os.makedirs(directory)
+    except Exception as error:
+        print('Unable to start: %s' % error, file = sys.stderr)
+        sys.exit(1)
+
+    try:
+        if start is None:
+            capture.follow()
+        else:
+            capture.save_all(capture.search(start, end))
+    except KeyboardInterrupt:
+        pass
+    except Exception as error:
+        print('Stopped: %s' % error, file = sys.stderr)
+        sys.exit(1)
@@ -0,0 +1,164 @@
+#   Streaming Matlab Files
+#
+# Support for writing Matlab version 5 .mat files incrementally.  Small arrays
+# are written in one go, but one large array can be streamed to disk in chunks:
+# its header is written first with provisional dimensions, the data is appended
+# as it arrives, and the dimensions and element sizes are patched in place once
+# the final size is known.  This means that the array never needs to be held in
+# memory.
+#
+# Note that the version 5 format limits each array to 4GB.
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+import time
+import struct
+import numpy
+
+
+# Data element types
+miINT8 = 1
+miINT32 = 5
+miUINT32 = 6
+miDOUBLE = 9
+miMATRIX = 14
+
+# Array classes, together with the corresponding element type and dtype.
+Classes = {
+    'double': (6,  miDOUBLE, numpy.dtype('<f8')),
+    'int32':  (12, miINT32,  numpy.dtype('<i4')),
+    'uint32': (13, miUINT32, numpy.dtype('<u4')),
+}
+
+MAX_ELEMENT_SIZE = 2**32 - 1
+
+# Offset of the Matlab datenum epoch from the Unix epoch, in days.
+MATLAB_EPOCH = 719529
+
+
+def utc_offset(timestamp, utc = False):
+    '''Returns the offset in seconds to be added to the given Unix timestamp to
+    convert to local time, or 0 if utc is set.'''
+    if utc:
+        return 0
+    else:
+        return time.localtime(timestamp).tm_gmtoff
+
+def datenum(timestamp, offset = 0):
+    '''Converts timestamps in seconds in the Unix epoch into Matlab datenum
+    format, days since year 0, after adding the given offset in seconds.'''
+    return (numpy.asarray(timestamp, dtype = numpy.float64) + offset) / 86400 \
+        + MATLAB_EPOCH
+
+
+def padding(length):
+    return b'\0' * (-length % 8)
+
+def element(type, data):
+    '''Returns a complete padded data element.'''
+    return struct.pack('<II', type, len(data)) + data + padding(len(data))
+
+
+class stream_matrix:
+    '''Handle for a matrix being streamed to a mat_file, created by
+    mat_file.begin_matrix().  Data is written in Matlab column major order,
+    so the last dimension is the one being extended.'''
+
+    def __init__(self, file, name, mclass, dims):
+        self.file = file
+        self.mclass, self.type, self.dtype = Classes[mclass]
+        self.dims = list(dims)
+        self.written = 0
+
+        self.start = file.tell()
+        header = \
+            element(miUINT32, struct.pack('<II', self.mclass, 0)) + \
+            self.__dims_element() + \
+            element(miINT8, name.encode())
+        # Leave the matrix and data element sizes to be filled in later.
+        file.write(struct.pack('<II', miMATRIX, 0))
+        file.write(header)
+        self.dims_offset = self.start + 8 + 16
+        self.data_offset = file.tell()
+        file.write(struct.pack('<II', self.type, 0))
+
+    def __dims_element(self):
+        return element(
+            miINT32, struct.pack('<%di' % len(self.dims), *self.dims))
+
+    def write(self, block):
+        block = numpy.ascontiguousarray(block, dtype = self.dtype)
+        matrix_size = \
+            self.data_offset + self.written + block.nbytes - self.start
+        if matrix_size > MAX_ELEMENT_SIZE:
+            raise ValueError('Matlab array too large for .mat file')
+        self.file.write(block)
+        self.written += block.nbytes
+
+    def close(self):
+        '''Completes the matrix, patching in the final size of the last
+        dimension.'''
+        self.file.write(padding(self.written))
+        end = self.file.tell()
+
+        inner = int(numpy.prod(self.dims[:-1]))
+        if inner:
+            self.dims[-1] = self.written // (self.dtype.itemsize * inner)
+        self.file.seek(self.start + 4)
+        self.file.write(struct.pack('<I', end - self.start - 8))
+        self.file.seek(self.dims_offset)
+        self.file.write(self.__dims_element())
+        self.file.seek(self.data_offset + 4)
+        self.file.write(struct.pack('<I', self.written))
+        self.file.seek(end)
+
+
+class mat_file:
+    '''m = mat_file(filename)
+
+    Writes a Matlab version 5 file.  Small arrays are written with m.write(),
+    large arrays can be streamed with m.begin_matrix().'''
+
+    def __init__(self, filename):
+        self.file = open(filename, 'w+b')
+        text = 'MATLAB 5.0 MAT-file, Platform: %s, Created on: %s' % (
+            'Python', time.strftime('%a %b %d %H:%M:%S %Y'))
+        self.file.write(text.encode().ljust(116) + b'\0' * 8)
+        self.file.write(struct.pack('<H', 0x0100) + b'IM')
+
+    def begin_matrix(self, name, mclass, dims):
+        '''Starts streaming a matrix of the given class, 'double', 'int32' or
+        'uint32'.  The last of the given dims will be updated on completion.'''
+        return stream_matrix(self.file, name, mclass, dims)
+
+    def write(self, name, value, mclass = 'double'):
+        '''Writes a complete array, converted to the given class.  One
+        dimensional arrays are written as row vectors.'''
+        value = numpy.asarray(value)
+        if value.ndim == 0:
+            dims = (1, 1)
+        elif value.ndim == 1:
+            dims = (1, len(value))
+        else:
+            dims = value.shape
+        matrix = self.begin_matrix(name, mclass, dims)
+        # Transposing gives us the data in Matlab column major order.
+        matrix.write(value.T)
+        matrix.close()
+
+    def close(self):
+        self.file.close()
@@ -0,0 +1,219 @@
+#   Capture File Reader
+#
+# Lazy access to captured data by time and FA id.  Every capture file written
+# by the writers module records a sparse index with one entry per captured
+# block giving the index of its first sample and its timestamp, so a time is
+# converted to a sample index by a binary search of the index followed by
+# interpolation within the block.  Only the data actually requested is then
+# touched: numpy captures are returned as memory mapped views, HDF5 captures
+# read only the chunks needed, and compressed captures decode only the chunks
+# containing the requested samples.
+#
+# For example, to fetch 200ms of data around a given time for two ids:
+#
+#   c = capture_reader('capture.npy')
+#   data = c.time['2011-06-01T14:03:07.412':'2011-06-01T14:03:07.612', [4, 5]]
+#
+# Times can be given as seconds in the Unix epoch, as datetime objects, or as
+# strings in the format accepted by the -s option of fa-capture.
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+import os
+import datetime
+import numpy
+
+from fa import falib
+from fa.capture import writers
+from fa.capture import compressed
+
+
+def to_seconds(value):
+    '''Converts a time to seconds in the Unix epoch.'''
+    if isinstance(value, str):
+        return falib.parse_time('s', value)
+    elif isinstance(value, datetime.datetime):
+        return value.timestamp()
+    else:
+        return float(value)
+
+
+class npy_capture:
+    def __init__(self, filename):
+        self.data = numpy.load(filename, mmap_mode = 'r')
+        meta = numpy.load(writers.meta_filename(filename))
+        self.index = meta['index']
+        self.gaps = meta['gaps']
+        self.attributes = dict(
+            (key, meta[key]) for key in meta.files
+            if key not in ['index', 'gaps'])
+
+    def read(self, start, end, columns):
+        return self.data[start:end][:, columns]
+
+
+class hdf5_capture:
+    def __init__(self, filename):
+        import h5py
+        self.h5 = h5py.File(filename, 'r')
+        self.data = self.h5['data']
+        self.index = self.h5['index'][:]
+        self.gaps = self.h5['gaps'][:]
+        self.attributes = dict(self.data.attrs)
+
+    def read(self, start, end, columns):
+        if isinstance(columns, slice):
+            return self.data[start:end, columns]
+        else:
+            # h5py only supports lists of increasing indices
+            return self.data[start:end][:, columns]
+
+
+class fac_capture:
+    def __init__(self, filename):
+        self.file = compressed.compressed_file(filename)
+        self.index = self.file.index
+        self.gaps = self.file.gaps
+        self.attributes = self.file.attributes
+        self.data = self.file
+
+    def read(self, start, end, columns):
+        return self.file.read(start, end)[:, columns]
+
+
+Readers = {
+    '.npy':  npy_capture,
+    '.h5':   hdf5_capture,
+    '.hdf5': hdf5_capture,
+    '.fac':  fac_capture,
+}
+
+
+class time_indexer:
+    '''Helper for capture_reader.time, converts time slices to sample slices.'''
+
+    def __init__(self, reader):
+        self.reader = reader
+
+    def __getitem__(self, key):
+        if isinstance(key, tuple):
+            times, ids = key
+        else:
+            times, ids = key, None
+        assert isinstance(times, slice) and times.step is None, \
+            'Time index must be a range of times'
+        start = 0
+        if times.start is not None:
+            start = self.reader.sample_at(times.start)
+        end = len(self.reader)
+        if times.stop is not None:
+            end = self.reader.sample_at(times.stop)
+        return self.reader[start:end, ids]
+
+
+class capture_reader:
+    '''c = capture_reader(filename)
+
+    Provides lazy access to a capture written by fa-capture in .npy, HDF5 or
+    compressed format.  Data can be indexed by sample and FA id as c[s0:s1, ids]
+    or by time and FA id as c.time[t0:t1, ids], where ids can be a single FA
+    id, a list of ids, a range of ids or omitted for all ids.  The result is
+    indexed by sample, id, [field,] and X/Y channel, as for the captured data.
+
+    The capture attributes are available as c.attributes, the block index as
+    c.index and gaps in the data as c.gaps.'''
+
+    def __init__(self, filename):
+        extension = os.path.splitext(filename)[1].lower()
+        try:
+            backend = Readers[extension]
+        except KeyError:
+            raise ValueError('Unsupported capture file %s' % filename)
+        self.backend = backend(filename)
+        self.data = self.backend.data
+        self.index = self.backend.index
+        self.gaps = self.backend.gaps
+        self.attributes = self.backend.attributes
+        self.ids = numpy.asarray(self.attributes['ids'])
+        self.block_size = int(self.attributes['block_size'])
+        self.time = time_indexer(self)
+
+    def __len__(self):
+        return len(self.data)
+
+    def columns(self, ids):
+        '''Converts a selection of FA ids into an index along the id axis,
+        returning a slice where possible so that no data is copied.'''
+        if ids is None:
+            return slice(None)
+        if isinstance(ids, slice):
+            # A slice selects the captured ids in the given range of ids.
+            low = -numpy.inf if ids.start is None else ids.start
+            high = numpy.inf if ids.stop is None else ids.stop
+            ids = self.ids[(low <= self.ids) & (self.ids < high)]
+        ids = numpy.atleast_1d(ids)
+        if len(ids) == 0:
+            return slice(0, 0)
+        columns = numpy.searchsorted(self.ids, ids)
+        if numpy.any(columns >= len(self.ids)) or \
+                numpy.any(self.ids[numpy.minimum(
+                    columns, len(self.ids) - 1)] != ids):
+            raise KeyError('FA ids %s not captured' % ids)
+        if len(columns) == 1 or numpy.all(numpy.diff(columns) == 1):
+            return slice(int(columns[0]), int(columns[-1]) + 1)
+        else:
+            return columns
+
+    def __getitem__(self, key):
+        if isinstance(key, tuple):
+            samples, ids = key
+        else:
+            samples, ids = key, None
+        assert isinstance(samples, slice) and samples.step is None, \
+            'Sample index must be a range of samples'
+        start, end, _ = samples.indices(len(self))
+        return self.backend.read(start, max(start, end), self.columns(ids))
+
+    def sample_at(self, timestamp):
+        '''Returns the index of the first sample at or after the given time.'''
+        timestamp = 1e6 * to_seconds(timestamp)
+        index = self.index
+        block = numpy.searchsorted(index['timestamp'], timestamp, 'right') - 1
+        if block < 0:
+            return 0
+        entry = index[block]
+        sample = entry['sample'] + int(numpy.ceil(
+            (timestamp - entry['timestamp']) * self.block_size /
+            entry['duration']))
+        # Don't run into the next block: this can happen if there is a gap.
+        if block + 1 < len(index):
+            sample = min(sample, index[block + 1]['sample'])
+        return int(min(max(sample, 0), len(self)))
+
+    def timestamps(self, start = 0, end = None):
+        '''Returns the timestamp in seconds of each of the given range of
+        samples, interpolated within each block.'''
+        if end is None:
+            end = len(self)
+        samples = numpy.arange(start, end)
+        index = self.index
+        blocks = numpy.searchsorted(index['sample'], samples, 'right') - 1
+        blocks = numpy.maximum(blocks, 0)
+        entries = index[blocks]
+        return 1e-6 * (entries['timestamp'] +
+            (samples - entries['sample']) * entries['duration'] /
+                self.block_size)
@@ -0,0 +1,393 @@
+#   Capture File Writers
+#
+# Captured data is streamed to disk block by block as it arrives so that memory
+# use is bounded however long the capture runs.  Each writer stores the data
+# array indexed by sample, FA id, [field,] and X/Y channel, together with a
+# sparse index recording the timestamp, duration and id0 of each captured block
+# and the list of gaps found in the data stream.
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+import os
+import sys
+import ast
+import struct
+import numpy
+
+from fa import falib
+from fa.capture import matlab
+from fa.capture import compressed
+
+
+# One entry per captured block.  The sample field is the index in the captured
+# data of the first sample of the block, and will be negative for the first
+# block if the capture started part way through a block.  Timestamps and
+# durations are in microseconds, id0 is 0 if not captured.
+index_dtype = numpy.dtype([
+    ('sample', '<i8'), ('timestamp', '<i8'),
+    ('duration', '<i8'), ('id0', '<i8')])
+
+data_dtype = numpy.dtype('<i4')
+
+
+class capture_writer:
+    '''Common code for capture file writers.  The shape is the shape of a single
+    sample, samples is the number of samples to be written if known in
+    advance, otherwise None, and info is a dictionary of attributes saved with
+    the capture.  Writer specific options are passed as keyword arguments to
+    the writers that need them.  At least the following attributes are
+    expected:
+        ids         List of captured FA ids
+        f_s         Sample frequency of captured data
+        decimation  Decimation factor, 1 for full rate data
+        block_size  Number of samples in a complete block
+        fields      Mask of decimated fields, 0 for full rate data
+    '''
+
+    def __init__(self, filename, shape, samples, info):
+        self.filename = filename
+        self.shape = tuple(shape)
+        self.samples = samples
+        self.info = info
+        self.written = 0
+        self.index = []
+
+    def write(self, timestamp, duration, id0, block, offset = 0):
+        '''Writes a block of data.  The offset is the number of samples at the
+        start of the block that were not delivered.'''
+        self.index.append(
+            (self.written - offset, timestamp, duration, id0 or 0))
+        self.write_data(numpy.ascontiguousarray(block, dtype = data_dtype))
+        self.written += len(block)
+
+    def index_array(self):
+        return numpy.array(self.index, dtype = index_dtype)
+
+    def close(self, gaps = None):
+        '''Completes the capture file, recording the given gaps, a numpy array
+        of falib.gap_dtype.'''
+        if gaps is None:
+            gaps = numpy.zeros(0, dtype = falib.gap_dtype)
+        self.close_data(gaps)
+
+    def attributes(self):
+        '''Returns the capture attributes as a flat dictionary.'''
+        attributes = dict(self.info)
+        attributes['ids'] = numpy.array(self.info['ids'])
+        attributes['timestamp'] = self.index[0][1] if self.index else 0
+        return attributes
+
+
+def npy_header(shape, header_size):
+    '''Returns an .npy format header for an int32 array of the given shape,
+    padded to exactly header_size bytes so that it can be rewritten later.'''
+    header = repr(dict(
+        descr = data_dtype.str, fortran_order = False, shape = tuple(shape)))
+    header = header.ljust(header_size - 11) + '\n'
+    assert len(header) == header_size - 10, 'Array shape too large for header'
+    return b'\x93NUMPY\x01\x00' + struct.pack('<H', len(header)) + \
+        header.encode('latin1')
+
+def read_npy_header(file):
+    '''Returns (dtype, shape, header_size) from an .npy file as written by
+    npy_writer.'''
+    magic = file.read(10)
+    assert magic[:8] == b'\x93NUMPY\x01\x00', 'Not a capture .npy file'
+    length = struct.unpack('<H', magic[8:10])[0]
+    header = ast.literal_eval(file.read(length).decode('latin1'))
+    assert not header['fortran_order']
+    return numpy.dtype(header['descr']), header['shape'], 10 + length
+
+def meta_filename(filename):
+    '''Returns the name of the file used to store the index and attributes of
+    an .npy capture.'''
+    return os.path.splitext(filename)[0] + '.meta.npz'
+
+
+class npy_writer(capture_writer):
+    '''Writes captured data to a numpy .npy file, with the index and attributes
+    saved to a separate .meta.npz file.  If the capture size is known in
+    advance the file is preallocated and written through a memory map,
+    otherwise data is appended and the header patched on completion.'''
+
+    HEADER_SIZE = 128
+
+    def __init__(self, filename, shape, samples, info, **kargs):
+        capture_writer.__init__(self, filename, shape, samples, info)
+        self.file = open(filename, 'w+b')
+        self.file.write(
+            npy_header((samples or 0,) + self.shape, self.HEADER_SIZE))
+        if samples:
+            self.data = numpy.memmap(
+                self.file, dtype = data_dtype, mode = 'r+',
+                offset = self.HEADER_SIZE, shape = (samples,) + self.shape)
+        else:
+            self.data = None
+
+    def write_data(self, block):
+        if self.data is None:
+            self.file.write(block)
+        else:
+            self.data[self.written:self.written + len(block)] = block
+
+    def close_data(self, gaps):
+        if self.data is not None:
+            self.data.flush()
+            del self.data
+        # Truncate the file to the data actually written (in case a memory
+        # mapped capture was cut short) and record the final shape.
+        shape = (self.written,) + self.shape
+        self.file.truncate(
+            self.HEADER_SIZE + data_dtype.itemsize * int(numpy.prod(shape)))
+        self.file.seek(0)
+        self.file.write(npy_header(shape, self.HEADER_SIZE))
+        self.file.close()
+
+        numpy.savez(meta_filename(self.filename),
+            index = self.index_array(), gaps = gaps, **self.attributes())
+
+
+class hdf5_writer(capture_writer):
+    '''Writes captured data to a chunked HDF5 file with datasets data, index
+    and gaps, and with the capture attributes stored as attributes of the data
+    set.'''
+
+    # Aim for chunks of around 1MB
+    CHUNK_BYTES = 1 << 20
+
+    def __init__(self, filename, shape, samples, info, **kargs):
+        import h5py
+        capture_writer.__init__(self, filename, shape, samples, info)
+        sample_bytes = data_dtype.itemsize * int(numpy.prod(self.shape))
+        chunk = max(1, self.CHUNK_BYTES // sample_bytes)
+        self.h5 = h5py.File(filename, 'w')
+        self.data = self.h5.create_dataset('data',
+            shape = (samples or 0,) + self.shape,
+            maxshape = (None,) + self.shape,
+            chunks = (chunk,) + self.shape, dtype = data_dtype)
+
+    def write_data(self, block):
+        end = self.written + len(block)
+        if end > len(self.data):
+            self.data.resize(end, axis = 0)
+        self.data[self.written:end] = block
+
+    def close_data(self, gaps):
+        self.data.resize(self.written, axis = 0)
+        for key, value in self.attributes().items():
+            self.data.attrs[key] = value
+        self.h5.create_dataset('index', data = self.index_array())
+        self.h5.create_dataset('gaps', data = gaps)
+        self.h5.close()
+
+
+class raw_writer(capture_writer):
+    '''Writes raw little endian sample data with no header or index, either to
+    the given file or to stdout if filename is None.'''
+
+    def __init__(self, filename, shape, samples, info, **kargs):
+        capture_writer.__init__(self, filename, shape, samples, info)
+        if filename is None:
+            self.file = sys.stdout.buffer
+        else:
+            self.file = open(filename, 'wb')
+
+    def write_data(self, block):
+        self.file.write(block)
+
+    def close_data(self, gaps):
+        self.file.flush()
+        if self.filename is not None:
+            self.file.close()
+
+
+class matlab_writer(capture_writer):
+    '''Writes captured data to a Matlab file in the format used by fa-capture
+    and fa_load: the data array is written as data(xy, [field,] [id,] t), with
+    the field and id dimensions omitted when they have length 1 unless
+    keep_dims is set, together with the following fields:
+        decimation, f_s, ids, timestamp, day, t, gaps, [id0]
+    The data array is streamed to disk as it arrives, the other fields are
+    written on completion.  Timestamps are in local time unless utc is set,
+    and the day is subtracted from t if subtract_day is set.'''
+
+    def __init__(self, filename, shape, samples, info,
+            name = 'data', keep_dims = False, utc = False,
+            subtract_day = False, save_id0 = False, **kargs):
+        capture_writer.__init__(self, filename, shape, samples, info)
+        self.utc = utc
+        self.subtract_day = subtract_day
+        self.save_id0 = save_id0
+
+        dims = [2]
+        if len(self.shape) == 3 and (keep_dims or self.shape[1] > 1):
+            dims.append(self.shape[1])
+        if keep_dims or self.shape[0] > 1:
+            dims.append(self.shape[0])
+        self.mat = matlab.mat_file(filename)
+        self.data = self.mat.begin_matrix(
+            name, 'int32', dims + [samples or 0])
+
+    def write_data(self, block):
+        self.data.write(block)
+
+    def __block_ranges(self):
+        '''Generates (start, end, entry) for each entry in the block index
+        giving the range of captured samples covered by the block.'''
+        index = self.index_array()
+        ends = numpy.append(index['sample'][1:], self.written)
+        for entry, end in zip(index, ends):
+            yield max(entry['sample'], 0), min(end, self.written), entry
+
+    def __write_t(self, day):
+        block_size = self.info['block_size']
+        matrix = self.mat.begin_matrix('t', 'double', [1, 0])
+        for start, end, entry in self.__block_ranges():
+            samples = numpy.arange(
+                start - entry['sample'], end - entry['sample'])
+            seconds = 1e-6 * (entry['timestamp'] +
+                entry['duration'] / block_size * samples)
+            offset = matlab.utc_offset(1e-6 * entry['timestamp'], self.utc)
+            matrix.write(matlab.datenum(seconds, offset) - day)
+        matrix.close()
+
+    def __write_id0(self):
+        decimation = self.info['decimation']
+        matrix = self.mat.begin_matrix('id0', 'uint32', [1, 0])
+        for start, end, entry in self.__block_ranges():
+            matrix.write((entry['id0'] + decimation * numpy.arange(
+                start - entry['sample'], end - entry['sample'])) % 2**32)
+        matrix.close()
+
+    def close_data(self, gaps):
+        self.data.close()
+
+        if self.index:
+            first = self.index[0]
+            seconds = 1e-6 * (first[1] - first[0] * first[2] /
+                self.info['block_size'])
+            timestamp = matlab.datenum(
+                seconds, matlab.utc_offset(seconds, self.utc))
+        else:
+            timestamp = 0
+        day = numpy.floor(timestamp)
+
+        self.mat.write('decimation', self.info['decimation'])
+        self.mat.write('f_s', self.info['f_s'])
+        self.mat.write('ids', self.info['ids'])
+        self.mat.write('timestamp', timestamp)
+        self.mat.write('day', day)
+        self.__write_t(day if self.subtract_day else 0)
+        self.mat.write('gaps', numpy.array(gaps.tolist()).reshape(-1, 4))
+        if self.save_id0:
+            self.__write_id0()
+        self.mat.close()
+
+
+class compressed_writer(capture_writer):
+    '''Writes captured data in the compressed capture format described in the
+    compressed module.  Incoming data is gathered into fixed size chunks, each
+    of which is encoded and written as soon as it is full.  The chunk size is
+    chosen to give chunks of around 1MB of uncompressed data.'''
+
+    CHUNK_BYTES = 1 << 20
+
+    def __init__(self, filename, shape, samples, info,
+            codec = 'zlib', level = None, **kargs):
+        capture_writer.__init__(self, filename, shape, samples, info)
+        if codec not in compressed.Compressors:
+            raise ValueError('Unknown codec %s' % codec)
+        self.codec = codec
+        if level is None:
+            level = {'zlib': 1, 'lzma': 0}[codec]
+        self.level = level
+
+        sample_bytes = data_dtype.itemsize * int(numpy.prod(self.shape))
+        self.chunk_size = max(1, self.CHUNK_BYTES // sample_bytes)
+        self.buffer = numpy.empty(
+            (self.chunk_size,) + self.shape, dtype = data_dtype)
+        self.buffered = 0
+        self.chunks = []
+
+        self.file = open(filename, 'wb')
+        self.file.write(compressed.MAGIC)
+
+    def __flush(self):
+        if self.buffered:
+            payload = compressed.encode_chunk(
+                self.buffer[:self.buffered], self.codec, self.level)
+            sample = self.chunk_size * len(self.chunks)
+            self.chunks.append(
+                (self.file.tell(), len(payload), sample, self.buffered))
+            self.file.write(payload)
+            self.buffered = 0
+
+    def write_data(self, block):
+        while len(block):
+            count = min(len(block), self.chunk_size - self.buffered)
+            self.buffer[self.buffered:self.buffered + count] = block[:count]
+            self.buffered += count
+            block = block[count:]
+            if self.buffered == self.chunk_size:
+                self.__flush()
+
+    def close_data(self, gaps):
+        self.__flush()
+        compressed.write_footer(self.file, self.chunks, self.shape, self.codec,
+            index = self.index_array(), gaps = gaps, **self.attributes())
+        self.file.close()
+
+
+Writers = {
+    '.npy':  npy_writer,
+    '.h5':   hdf5_writer,
+    '.hdf5': hdf5_writer,
+    '.mat':  matlab_writer,
+    '.fac':  compressed_writer,
+}
+
+def open_writer(filename, raw, shape, samples, info, **kargs):
+    '''Returns a writer for the given filename, choosing the file format from
+    the file extension unless raw is set.'''
+    if raw or filename is None:
+        return raw_writer(filename, shape, samples, info)
+    extension = os.path.splitext(filename)[1].lower()
+    try:
+        writer = Writers[extension]
+    except KeyError:
+        raise ValueError(
+            'Unknown capture file extension "%s", use one of %s or -R' % (
+                extension, ', '.join(sorted(Writers))))
+    return writer(filename, shape, samples, info, **kargs)
+
+def write_blocks(filename, blocks, offset, info):
+    '''Writes a complete capture of full rate data, in the format given by the
+    extension of filename, from a list of (timestamp, duration, id0, data)
+    blocks as returned by read_extended() with id0 enabled, where the first
+    offset samples of the first block are omitted from its data.  Gaps in the
+    blocks, including gaps in id0, are saved with the capture.'''
+    samples = sum(len(data) for _, _, _, data in blocks)
+    writer = open_writer(filename, False, (len(info['ids']), 2), samples, info,
+        save_id0 = True)
+    checker = falib.continuity(info['block_size'], offset, True)
+    try:
+        for timestamp, duration, id0, data in blocks:
+            checker.check(timestamp, duration, id0)
+            writer.write(timestamp, duration, id0, data, offset)
+            offset = 0
+    finally:
+        writer.close(checker.gap_array())
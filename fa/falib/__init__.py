@@ -28,8 +28,44 @@
 
 from fa.falib import falib
 from fa.falib import config
+from fa.falib import gaps
+from fa.falib import times
+from fa.falib import lines
+from fa.falib import zoom
+from fa.falib import allan
+from fa.falib import variance
+from fa.falib import search
+from fa.falib import fetch
+from fa.falib import trips
+from fa.falib import triggers
+from fa.falib import anomaly
+from fa.falib import spectra
+from fa.falib import coherence
+from fa.falib import pca
+from fa.falib import virtual
+from fa.falib import correlation
 
 from fa.falib.falib import *
 from fa.falib.config import *
+from fa.falib.gaps import *
+from fa.falib.times import *
+from fa.falib.lines import *
+from fa.falib.zoom import *
+from fa.falib.allan import *
+from fa.falib.variance import *
+from fa.falib.search import *
+from fa.falib.fetch import *
+from fa.falib.trips import *
+from fa.falib.triggers import *
+from fa.falib.anomaly import *
+from fa.falib.spectra import *
+from fa.falib.coherence import *
+from fa.falib.pca import *
+from fa.falib.virtual import *
+from fa.falib.correlation import *
 
-__all__ = falib.__all__ + config.__all__
+__all__ = falib.__all__ + config.__all__ + gaps.__all__ + times.__all__ + \
+    lines.__all__ + zoom.__all__ + allan.__all__ + variance.__all__ + \
+    search.__all__ + fetch.__all__ + trips.__all__ + \
+    triggers.__all__ + anomaly.__all__ + spectra.__all__ + \
+    coherence.__all__ + pca.__all__ + virtual.__all__ + correlation.__all__
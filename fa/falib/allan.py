@@ -0,0 +1,147 @@
+# Streaming overlapping Allan deviation
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# The Allan variance at averaging time tau = m samples is half the mean square
+# difference between the means of adjacent windows of m samples.  The
+# overlapping estimator slides the pair of windows one sample at a time, which
+# for long tau means keeping 2m samples of history per channel.
+#
+# Here data is instead summed into a dyadic pyramid: level j is a stream of sums
+# of 2^j consecutive samples, each produced by adding a pair of sums from level
+# j-1.  Each level keeps the running sum of its stream over just the last
+# 2*OVERLAP values, from which the difference between adjacent windows of
+# OVERLAP values is available at every step.  Level 0 computes every tau up to
+# OVERLAP samples fully overlapped, and level j computes tau = OVERLAP * 2^j
+# with the windows stepped by 2^j samples, which is statistically almost as
+# good as full overlap.  The cost per sample is O(log N) for N levels, and the
+# memory is O(OVERLAP * levels) per channel.
+
+import numpy
+
+
+__all__ = ['allan_pyramid', 'allan_deviation']
+
+
+class allan_pyramid:
+    '''a = allan_pyramid(f_s, shape=(2,), levels=22, overlap=16)
+
+    Accumulates the overlapping Allan variance of a stream of data sampled at
+    f_s for averaging times from one sample up to overlap * 2^levels samples in
+    powers of two.  Each sample has the given shape, for example (ids, 2).
+
+    Blocks of data indexed by sample are passed to a.update(), after which
+    a.taus lists the averaging times in seconds and a.deviation() returns the
+    Allan deviation for each tau, of shape (taus,) + shape, in the units of the
+    data.  Averaging times for which there is not yet enough data are nan.'''
+
+    def __init__(self, f_s, shape = (2,), levels = 22, overlap = 16):
+        assert overlap & (overlap - 1) == 0, 'Overlap must be a power of 2'
+        self.f_s = f_s
+        self.shape = tuple(shape)
+        self.levels = levels
+        self.overlap = overlap
+
+        # The lags in values of each level of the pyramid and the
+        # corresponding averaging times in samples.
+        self.lags = [2 ** numpy.arange(int(numpy.log2(overlap)) + 1)] + \
+            [numpy.array([overlap])] * levels
+        self.m = numpy.concatenate([
+            lags * 2 ** level for level, lags in enumerate(self.lags)])
+        self.taus = self.m / f_s
+        self.reset()
+
+    def reset(self):
+        channels = int(numpy.prod(self.shape))
+        # For each level the running sums of the last 2*overlap values, the
+        # number of values seen, and any value waiting for its partner.
+        self.history = [
+            numpy.zeros((2 * self.overlap + 1, channels))
+            for _ in self.lags]
+        self.seen = numpy.zeros(len(self.lags), dtype = numpy.int64)
+        self.carry = [None] * len(self.lags)
+        self.squares = numpy.zeros((len(self.m), channels))
+        self.counts = numpy.zeros(len(self.m), dtype = numpy.int64)
+        self.reference = None
+
+    def __level(self, level, values, start):
+        '''Adds new values to the given level, accumulating the square window
+        differences for each of its lags.  start is the index into
+        self.squares of the first lag.'''
+        history = self.history[level]
+        keep = len(history)
+        running = numpy.concatenate((
+            history, history[-1] + numpy.cumsum(values, axis = 0)))
+        seen = self.seen[level]
+        for i, lag in enumerate(self.lags[level]):
+            # Differences are only valid once 2*lag values have been seen.
+            first = max(keep, keep + 2 * lag - seen - 1)
+            if first < len(running):
+                ends = running[first:]
+                diff = ends - 2 * running[first - lag:len(running) - lag] + \
+                    running[first - 2 * lag:len(running) - 2 * lag]
+                self.squares[start + i] += numpy.sum(diff ** 2, axis = 0)
+                self.counts[start + i] += len(diff)
+        self.seen[level] = seen + len(values)
+        # Only differences of the running sum matter, so rebase the history to
+        # stop it growing.
+        self.history[level] = running[-keep:] - running[-keep]
+
+    def update(self, block):
+        '''Adds a block of data to the pyramid.'''
+        if len(block) == 0:
+            return
+        values = numpy.float64(block.reshape(len(block), -1))
+        if self.reference is None:
+            self.reference = values[0].copy()
+        values = values - self.reference
+
+        start = 0
+        for level in range(len(self.lags)):
+            self.__level(level, values, start)
+            start += len(self.lags[level])
+
+            # Pair up values to form the next level of the pyramid.
+            if self.carry[level] is not None:
+                values = numpy.concatenate((self.carry[level], values))
+            pairs = len(values) // 2
+            if len(values) % 2:
+                self.carry[level] = values[-1:]
+            else:
+                self.carry[level] = None
+            if pairs == 0:
+                break
+            values = values[:2 * pairs:2] + values[1:2 * pairs:2]
+
+    def deviation(self):
+        '''Returns the Allan deviation for each averaging time.'''
+        with numpy.errstate(invalid = 'ignore', divide = 'ignore'):
+            variance = self.squares / (
+                2 * (self.m ** 2 * self.counts)[:, None])
+        variance[self.counts == 0] = numpy.nan
+        return numpy.sqrt(variance).reshape((len(self.m),) + self.shape)
+
+
+def allan_deviation(data, f_s, **kargs):
+    '''Computes the overlapping Allan deviation of data indexed by sample and
+    sampled at f_s.  Returns the averaging times in seconds and the deviation
+    for each, omitting averaging times which are too long for the data.
+    Further arguments are passed to allan_pyramid.'''
+    pyramid = allan_pyramid(f_s, data.shape[1:], **kargs)
+    pyramid.update(data)
+    valid = pyramid.counts > 0
+    return pyramid.taus[valid], pyramid.deviation()[valid]
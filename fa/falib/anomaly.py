@@ -0,0 +1,166 @@
+# Streaming detection of misbehaving BPMs
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# A BPM going bad usually shows up in its own statistics well before anyone
+# notices it on the orbit: its noise grows, or its readings freeze at a constant
+# value.  The detector keeps per id and per plane statistics for every id of a
+# single full rate subscription, all as arrays of fixed shape updated a whole
+# block at a time, so the cost per sample is a handful of array operations
+# whatever the number of ids.
+#
+# Mean, variance, min and max are accumulated over a fixed window of samples.
+# At the end of each window they are checked against the limits and folded into
+# a running baseline of the noise of each id, so a BPM can also be flagged for
+# becoming much noisier than it normally is.  Stuck values are counted sample
+# by sample as the length of the current run of identical readings.
+
+import numpy
+
+from fa.falib.variance import sample_moments, combine_moments
+
+
+__all__ = ['anomaly_limits', 'anomaly_detector']
+
+
+class anomaly_limits:
+    '''Limits for anomaly_detector, all optional, in archive units (nm):
+        noise       Largest standard deviation over a window
+        ratio       Largest standard deviation over a window as a multiple of
+                    the running baseline standard deviation
+        span        Largest max - min over a window
+        stuck       Longest run of identical samples, in samples
+    '''
+
+    def __init__(self, noise = None, ratio = None, span = None, stuck = None):
+        self.noise = noise
+        self.ratio = ratio
+        self.span = span
+        self.stuck = stuck
+
+
+class anomaly_detector:
+    '''d = anomaly_detector(ids, limits, window=10000, smoothing=0.01)
+
+    Checks full rate data for the given ids, passed block by block to
+    d.update(), for anomalies beyond the given anomaly_limits.  Statistics are
+    gathered over windows of the given number of samples, and the baseline
+    noise is an exponential average over windows with the given smoothing
+    factor.
+
+    Each anomaly is reported when it starts and again when it clears, as a
+    tuple (sample, fa_id, axis, kind, active, value).  Here sample is the
+    number of samples since the detector started up to the end of the block
+    or window where the change was seen, axis is 0 for X and 1 for Y, kind is
+    one of anomaly_detector.Kinds, active is True when the anomaly starts, and
+    value is the statistic checked against the limit.'''
+
+    Kinds = ['noise', 'ratio', 'span', 'stuck']
+
+    def __init__(self, ids, limits, window = 10000, smoothing = 0.01):
+        self.ids = list(ids)
+        self.limits = limits
+        self.window = window
+        self.smoothing = smoothing
+        shape = (len(self.ids), 2)
+
+        self.samples = 0                # Total samples seen
+        self.count = 0                  # Samples in current window
+        self.mean = numpy.zeros(shape)
+        self.m2 = numpy.zeros(shape)
+        self.min = numpy.full(shape, numpy.inf)
+        self.max = numpy.full(shape, -numpy.inf)
+        self.baseline = numpy.full(shape, numpy.nan)
+        self.last = None
+        self.run = numpy.zeros(shape, dtype = numpy.int64)
+        self.active = numpy.zeros((len(self.Kinds),) + shape, dtype = bool)
+
+    def update(self, block):
+        '''Updates the statistics with a block of full rate data indexed by
+        sample, id and X/Y, returns a list of anomaly reports.'''
+        events = []
+        while len(block):
+            # Split the block at the end of the current window.
+            part = block[:self.window - self.count]
+            block = block[len(part):]
+            self.__accumulate(part)
+            self.samples += len(part)
+            if self.limits.stuck is not None:
+                events.extend(self.__check_stuck(part))
+            if self.count >= self.window:
+                events.extend(self.__check_window())
+        return events
+
+    def __accumulate(self, part):
+        self.count, self.mean, self.m2 = combine_moments(
+            self.count, self.mean, self.m2, *sample_moments(part))
+        numpy.minimum(self.min, part.min(axis = 0), out = self.min)
+        numpy.maximum(self.max, part.max(axis = 0), out = self.max)
+
+    def __check_stuck(self, part):
+        if self.last is None:
+            self.last = part[0]
+        # A sample differing from its predecessor starts a new run.
+        changed = numpy.empty(part.shape, dtype = bool)
+        changed[0] = part[0] != self.last
+        changed[1:] = part[1:] != part[:-1]
+        self.last = part[-1]
+        # The run at the end of the part is the number of samples since the
+        # last change, or extends the previous run if there was no change.
+        last_change = len(part) - 1 - numpy.argmax(changed[::-1], axis = 0)
+        any_change = changed.any(axis = 0)
+        self.run = numpy.where(
+            any_change, len(part) - last_change, self.run + len(part))
+        return self.__report(3, self.run, self.run > self.limits.stuck)
+
+    def __check_window(self):
+        std = numpy.sqrt(self.m2 / self.count)
+        events = []
+        if self.limits.noise is not None:
+            events.extend(self.__report(0, std, std > self.limits.noise))
+        if self.limits.ratio is not None:
+            with numpy.errstate(invalid = 'ignore'):
+                ratio = std / self.baseline
+            events.extend(self.__report(1, ratio, ratio > self.limits.ratio))
+        if self.limits.span is not None:
+            span = self.max - self.min
+            events.extend(self.__report(2, span, span > self.limits.span))
+
+        # Only windows without a noise anomaly update the baseline, so that a
+        # noisy BPM doesn't raise its own baseline.
+        quiet = ~self.active[:2].any(axis = 0)
+        first = numpy.isnan(self.baseline)
+        self.baseline = numpy.where(first, std, numpy.where(quiet,
+            self.baseline + self.smoothing * (std - self.baseline),
+            self.baseline))
+
+        self.count = 0
+        self.mean[:] = 0
+        self.m2[:] = 0
+        self.min[:] = numpy.inf
+        self.max[:] = -numpy.inf
+        return events
+
+    def __report(self, kind, value, state):
+        '''Updates the state of one kind of anomaly, returns reports for each
+        id and axis where it has changed.'''
+        changed = numpy.argwhere(state != self.active[kind])
+        self.active[kind] = state
+        return [
+            (self.samples, self.ids[id], int(axis), self.Kinds[kind],
+                bool(state[id, axis]), float(value[id, axis]))
+            for id, axis in changed]
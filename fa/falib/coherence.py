@@ -0,0 +1,139 @@
+# Streaming cross spectral density and coherence
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Whether a spectral line seen on two BPMs (or on X and Y of one BPM) has a
+# common cause is answered by their coherence: the squared magnitude of the
+# cross spectral density normalised by the two power spectral densities.  Its
+# phase gives the relative phase of the common motion.  A single pair of
+# segments always has a coherence of one, so the spectra must be averaged over
+# many segments before the coherence means anything.
+#
+# Spectra are averaged by Welch's method with Hann windowed segments
+# overlapping by half.  Samples are gathered until a segment is complete, and
+# each complete segment is transformed once and added into running sums of the
+# auto and cross spectra, so the cost of an update doesn't grow with the
+# length of history averaged.  Averaging is either over all segments since the
+# last reset or exponential with a given number of segments' time constant.
+
+import numpy
+
+
+__all__ = ['cross_spectrum']
+
+
+class cross_spectrum:
+    '''c = cross_spectrum(f_s, length, shape=(2,), averages=None)
+
+    Welch averaged spectra of two streams of data sampled at f_s, transformed in
+    segments of the given length.  Each sample of each stream has the given
+    shape, and the spectra are computed separately for each channel.  Matching
+    blocks of the two streams, indexed by sample, are passed to c.update(a, b).
+    If averages is None all segments since the last c.reset() are averaged
+    equally, otherwise segments are averaged exponentially with a time constant
+    of averages segments.
+
+    The frequencies of the spectra are in c.frequencies and the number of
+    segments averaged in c.count.'''
+
+    def __init__(self, f_s, length, shape = (2,), averages = None):
+        self.f_s = f_s
+        self.length = length
+        self.step = length // 2
+        self.shape = tuple(shape)
+        self.averages = averages
+
+        self.frequencies = f_s * numpy.arange(length // 2) / length
+        self.window = 1 + numpy.cos(
+            numpy.linspace(-numpy.pi, numpy.pi, length))
+        # Scales |fft|^2 of a windowed segment to a one sided density.
+        self.scale = 2.0 / (f_s * numpy.sum(self.window**2))
+        self.reset()
+
+    def reset(self):
+        shape = (len(self.frequencies),) + self.shape
+        self.saa = numpy.zeros(shape)
+        self.sbb = numpy.zeros(shape)
+        self.sab = numpy.zeros(shape, dtype = numpy.complex128)
+        self.count = 0
+        # Samples not yet covered by a complete segment.
+        self.pending = numpy.zeros((0, 2) + self.shape)
+
+    def update(self, a, b):
+        '''Adds matching blocks of samples of the two streams.'''
+        block = numpy.stack((a, b), axis = 1)
+        data = numpy.concatenate((self.pending, block))
+        segments = max(0, (len(data) - self.length) // self.step + 1)
+        if segments:
+            # All complete segments are transformed together.
+            starts = self.step * numpy.arange(segments)
+            index = starts[:, None] + numpy.arange(self.length)
+            segment = data[index]
+            segment = segment - segment.mean(axis = 1, keepdims = True)
+            window = self.window.reshape((1, -1) + (1,) * (segment.ndim - 2))
+            fft = numpy.fft.rfft(segment * window, axis = 1)
+            fft = fft[:, :len(self.frequencies)]
+            fa = fft[:, :, 0]
+            fb = fft[:, :, 1]
+            self.__add(
+                numpy.abs(fa)**2, numpy.abs(fb)**2, fa * numpy.conj(fb),
+                segments)
+        self.pending = data[segments * self.step:]
+
+    def __add(self, saa, sbb, sab, segments):
+        if self.averages is None:
+            self.saa += saa.sum(axis = 0)
+            self.sbb += sbb.sum(axis = 0)
+            self.sab += sab.sum(axis = 0)
+        else:
+            # Exponential averaging, one segment at a time, starting with an
+            # equal average until there are enough segments.
+            for n in range(segments):
+                alpha = 1.0 / min(self.count + n + 1, self.averages)
+                self.saa += alpha * (saa[n] - self.saa)
+                self.sbb += alpha * (sbb[n] - self.sbb)
+                self.sab += alpha * (sab[n] - self.sab)
+        self.count += segments
+
+    def __mean(self, s):
+        if self.averages is None:
+            return s / max(self.count, 1)
+        else:
+            return s
+
+    def psd(self):
+        '''Returns the power spectral densities of the two streams, in units
+        squared per Hz, each indexed by frequency and channel.'''
+        return \
+            self.scale * self.__mean(self.saa), \
+            self.scale * self.__mean(self.sbb)
+
+    def csd(self):
+        '''Returns the complex cross spectral density of the two streams.'''
+        return self.scale * self.__mean(self.sab)
+
+    def coherence(self):
+        '''Returns the magnitude squared coherence of the two streams, between
+        0 and 1.'''
+        with numpy.errstate(invalid = 'ignore', divide = 'ignore'):
+            result = numpy.abs(self.sab)**2 / (self.saa * self.sbb)
+        return numpy.nan_to_num(result)
+
+    def phase(self):
+        '''Returns the phase of the first stream relative to the second in
+        degrees.'''
+        return numpy.degrees(numpy.angle(self.sab))
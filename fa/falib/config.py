@@ -77,7 +77,7 @@ def list_location_files():
 
 
 def load_location_file(globs, location, full_path, server = None, port = None):
-    result = dict(FA_PORT = falib.DEFAULT_PORT)
+    result = dict(FA_PORT = falib.DEFAULT_PORT, VIRTUAL = [])
     config_file = find_location_file(location, full_path)
     context = dict(here = os.path.dirname(config_file), os = os)
     with open(config_file, 'rb') as src:
@@ -0,0 +1,170 @@
+# Streaming cross correlation and delay estimation between BPMs
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# A disturbance entering the beam at one point of the ring reaches the BPMs
+# around it at slightly different times, and the delay between the motion at
+# two BPMs is the position of the peak of their cross correlation.  The cross
+# correlation is the inverse transform of the cross spectrum, so as for
+# cross_spectrum the cross spectra of successive segments are averaged as data
+# arrives.  Unlike cross_spectrum the segments are neither windowed nor
+# overlapped: each is zero padded to twice its length so that the correlation
+# doesn't wrap around, and the sum over back to back segments is then the
+# correlation of the whole stream, less the products spanning segment
+# boundaries.  This halves the work of overlapping segments.  The spectra of all
+# ids are computed together with one FFT per segment, and only the averaged
+# cross spectrum of each selected pair is transformed back when delays are
+# wanted, so the cost of following every BPM against a reference is dominated
+# by the one forward FFT.
+#
+# The delay is found to a fraction of a sample by fitting a parabola through the
+# largest correlation and its two neighbours.  The peak correlation is
+# normalised by the power of the two ids, so is between -1 and 1, and a negative
+# peak means the two ids move in opposition.
+
+import numpy
+
+
+__all__ = ['delay_estimator']
+
+
+class delay_estimator:
+    '''d = delay_estimator(ids, pairs, length, averages=None, band=None,
+        max_delay=None)
+
+    Averages the cross spectra of the given list of pairs of FA ids, each
+    pair an (a, b) tuple of ids from ids, over segments of the given length.
+    Blocks of data indexed by sample, id and X/Y, for all of ids in order, are
+    added with d.update(block).  If averages is None all segments since the last
+    d.reset() are averaged equally, otherwise segments are averaged
+    exponentially with a time constant of averages segments.  If band is given
+    as a (low, high) pair of fractions of the sample frequency then only motion
+    in that band is correlated.  Delays are searched for up to max_delay
+    samples either way, by default half the segment length.
+
+    d.delays() returns the delay of b relative to a in samples and the peak
+    correlation for each pair and axis.'''
+
+    def __init__(self, ids, pairs, length, averages = None, band = None,
+            max_delay = None):
+        self.ids = list(ids)
+        self.pairs = list(pairs)
+        self.length = length
+        self.averages = averages
+        self.max_delay = min(max_delay or length // 2, length - 1)
+
+        # Only the ids used by some pair need be transformed.  Data is kept
+        # with X and Y of each of these ids as rows, so that each segment is
+        # contiguous for the FFT.
+        used = sorted(set(id for pair in self.pairs for id in pair))
+        self.columns = numpy.array([self.ids.index(id) for id in used])
+        self.rows = 2 * len(used)
+        self.a = numpy.array([
+            2 * used.index(a) + axis for a, _ in self.pairs for axis in (0, 1)])
+        self.b = numpy.array([
+            2 * used.index(b) + axis for _, b in self.pairs for axis in (0, 1)])
+
+        self.fft_length = 2 * length
+        bins = self.fft_length // 2 + 1
+        # Weights turning a spectrum into the inverse transform at zero lag,
+        # restricted to the selected band.
+        self.weights = numpy.full(bins, 2.0 / self.fft_length)
+        self.weights[[0, -1]] = 1.0 / self.fft_length
+        self.mask = numpy.ones(bins, dtype = bool)
+        if band is not None:
+            frequency = numpy.arange(bins) / self.fft_length
+            low, high = band
+            self.mask = (low <= frequency) & (frequency < high)
+        self.weights[~self.mask] = 0
+        self.reset()
+
+    def reset(self):
+        bins = self.fft_length // 2 + 1
+        self.power = numpy.zeros((self.rows, bins))
+        self.cross = numpy.zeros((len(self.a), bins), dtype = numpy.complex128)
+        self.count = 0
+        # Samples not yet covered by a complete segment.
+        self.pending = numpy.zeros((self.rows, 0))
+
+    def update(self, block):
+        '''Adds a block of data indexed by sample, id and X/Y.'''
+        block = numpy.take(block, self.columns, axis = 1).reshape(
+            (len(block), self.rows))
+        data = numpy.concatenate((self.pending, block.T), axis = 1)
+        segments = data.shape[1] // self.length
+        if segments:
+            # All complete segments of all ids are transformed together.
+            segment = data[:, :segments * self.length].reshape(
+                (self.rows, segments, self.length))
+            segment = segment - segment.mean(axis = 2, keepdims = True)
+            fft = numpy.fft.rfft(segment, n = self.fft_length, axis = 2)
+            self.__add(
+                fft.real**2 + fft.imag**2,
+                numpy.conj(fft[self.a]) * fft[self.b],
+                segments)
+        self.pending = data[:, segments * self.length:]
+
+    def __add(self, power, cross, segments):
+        if self.averages is None:
+            self.power += power.sum(axis = 1)
+            self.cross += cross.sum(axis = 1)
+        else:
+            # As for cross_spectrum, equal averaging until there are enough
+            # segments for the time constant.
+            for n in range(segments):
+                alpha = 1.0 / min(self.count + n + 1, self.averages)
+                self.power *= 1 - alpha
+                self.power += alpha * power[:, n]
+                self.cross *= 1 - alpha
+                self.cross += alpha * cross[:, n]
+        self.count += segments
+
+    def correlation(self):
+        '''Returns the normalised cross correlation of each pair indexed by lag
+        from -max_delay to max_delay, pair and X/Y.  A peak at a positive lag
+        means that b follows a.'''
+        cross = numpy.where(self.mask, self.cross, 0)
+        result = numpy.fft.irfft(cross, n = self.fft_length, axis = 1)
+        lags = numpy.arange(-self.max_delay, self.max_delay + 1)
+        result = result[:, lags]
+
+        energy = numpy.dot(self.power, self.weights)
+        scale = numpy.sqrt(energy[self.a] * energy[self.b])
+        with numpy.errstate(invalid = 'ignore', divide = 'ignore'):
+            result = result / scale[:, None]
+        return numpy.nan_to_num(result.T.reshape((len(lags), -1, 2)))
+
+    def delays(self):
+        '''Returns (delay, peak) each indexed by pair and X/Y, the delay of b
+        relative to a in samples and the normalised correlation at the peak.'''
+        correlation = self.correlation()
+        lags = len(correlation)
+        peak = numpy.argmax(numpy.abs(correlation), axis = 0)
+        # Fit a parabola through the peak and its neighbours, leaving peaks at
+        # the ends of the range of lags unrefined.
+        inside = (0 < peak) & (peak < lags - 1)
+        centre = numpy.clip(peak, 1, lags - 2)
+        left, middle, right = [
+            numpy.take_along_axis(correlation, (centre + n)[None], 0)[0]
+            for n in (-1, 0, 1)]
+        curvature = left - 2 * middle + right
+        with numpy.errstate(invalid = 'ignore', divide = 'ignore'):
+            offset = 0.5 * (left - right) / curvature
+        offset = numpy.where(inside & (curvature != 0), offset, 0)
+        height = numpy.take_along_axis(correlation, peak[None], 0)[0]
+        height = height - 0.25 * (left - right) * offset
+        return peak + offset - self.max_delay, height
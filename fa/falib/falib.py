@@ -34,10 +34,12 @@ import numpy
 import cothread
 from cothread import cosocket
 
+from fa.falib.virtual import virtual_ids
+
 
 __all__ = [
-    'connection', 'subscription', 'get_sample_frequency', 'get_decimation',
-    'Server']
+    'connection', 'subscription', 'archive', 'parse_mask',
+    'get_sample_frequency', 'get_decimation', 'get_archived_ids', 'Server']
 
 
 def format_mask(mask):
@@ -65,6 +67,24 @@ def format_mask(mask):
     return count, ','.join(ranges)
 
 
+def parse_mask(mask):
+    '''Parses a list of FA ids written as a comma separated list of ids or
+    ranges of ids, for example "1-172,200", and returns a sorted list of ids.'''
+    result = set()
+    for part in mask.split(','):
+        range_ids = part.split('-')
+        if len(range_ids) == 1:
+            result.add(int(part))
+        elif len(range_ids) == 2:
+            first, last = map(int, range_ids)
+            if first > last:
+                raise ValueError('Invalid id range %s' % part)
+            result.update(range(first, last + 1))
+        else:
+            raise ValueError('Invalid id range %s' % part)
+    return sorted(result)
+
+
 class connection:
     class EOF(Exception):
         pass
@@ -117,6 +137,36 @@ class connection:
         self.buf = buf
         return result
 
+    def check_response(self):
+        '''Checks for the null byte sent by the server on success, otherwise
+        raises the error message returned by the server.'''
+        c = self.recv(1).decode()
+        if c != chr(0):
+            raise self.Error((c + self.recv().decode())[:-1])    # Discard trailing \n
+
+    def read_header(self, dtype):
+        '''Reads a single little endian structure of the given numpy dtype.'''
+        return self.read_block(dtype.itemsize).view(dtype)[0]
+
+    def read_stream_header(self):
+        '''Reads the header at the start of an extended timestamp stream.'''
+        header = self.read_header(stream_header)
+        self.block_size = int(header['block_size'])
+        self.offset = int(header['offset'])
+        if self.id0:
+            self.header = block_header_id0
+        else:
+            self.header = block_header
+
+
+# Headers sent at the start of each data block when extended timestamps are
+# requested with TE or TEZ.
+block_header = numpy.dtype([('timestamp', '<u8'), ('duration', '<u4')])
+block_header_id0 = numpy.dtype(
+    [('timestamp', '<u8'), ('duration', '<u4'), ('id0', '<u4')])
+# Header sent once at the start of an extended timestamp data stream.
+stream_header = numpy.dtype([('block_size', '<u4'), ('offset', '<u4')])
+
 
 class subscription(connection):
     '''s = subscription(bpm_list, decimated, server, port)
@@ -125,20 +175,30 @@ class subscription(connection):
     server if not specified) returning continuous data for the selected bpms.
     The s.read() method must be called frequently enough to ensure that the
     connection to the server doesn't overflow.
+
+    If extended is set then the stream is requested with extended timestamps
+    (and with id0 if id0 is also set) and must be read with s.read_extended()
+    rather than s.read().
     '''
 
-    def __init__(self, mask, decimated=False, uncork=False, **kargs):
+    def __init__(self, mask, decimated=False, uncork=False,
+            extended=False, id0=False, **kargs):
         connection.__init__(self, **kargs)
         self.count, format = format_mask(mask)
         self.decimated = decimated
+        self.extended = extended
+        self.id0 = extended and id0
 
         flags = ''
+        if extended: flags = flags + 'TE'
+        if self.id0: flags = flags + 'Z'
         if uncork: flags = flags + 'U'
         if decimated: flags = flags + 'D'
         self.sock.send(('S%s%s\n' % (format, flags)).encode())
-        c = self.recv(1).decode()
-        if c != chr(0):
-            raise self.Error((c + self.recv().decode())[:-1])    # Discard trailing \n
+        self.check_response()
+
+        if extended:
+            self.read_stream_header()
 
     def read(self, samples):
         '''Returns a waveform of samples indexed by sample count, bpm count
@@ -146,10 +206,128 @@ class subscription(connection):
             wf = s.read(N)
         wf[n, b, x] = sample n of BPM b on channel x, where x=0 for horizontal
         position and x=1 for vertical position.'''
+        assert not self.extended, 'Use read_extended() with extended timestamps'
         raw = self.read_block(8 * samples * self.count)
         array = numpy.frombuffer(raw, dtype = numpy.int32)
         return array.reshape((samples, self.count, 2))
 
+    def read_extended(self):
+        '''Reads one complete block from an extended timestamp stream and
+        returns (timestamp, duration, id0, wf), where timestamp and duration are
+        in microseconds, id0 is None unless requested, and wf is as returned by
+        read().'''
+        header = self.read_header(self.header)
+        if self.id0:
+            id0 = int(header['id0'])
+        else:
+            id0 = None
+        raw = self.read_block(8 * self.block_size * self.count)
+        array = numpy.frombuffer(raw, dtype = numpy.int32)
+        return (
+            int(header['timestamp']), int(header['duration']), id0,
+            array.reshape((self.block_size, self.count, 2)))
+
+
+def format_time(seconds):
+    '''Formats a time in seconds in the Unix epoch for a read request.'''
+    whole = int(seconds // 1)
+    return 'S%d.%09d' % (whole, round((seconds - whole) * 1e9))
+
+
+class archive(connection):
+    '''a = archive(bpm_list, start, end=None, samples=None, source='F', ...)
+
+    Creates a connection to the given FA archiver server reading historical data
+    for the selected bpms from the archive, starting at start (in seconds in the
+    Unix epoch) and either ending at end or after the given number of samples.
+    The source can be 'F' for full rate data or 'D' or 'DD' for decimated data,
+    in which case fields is a mask selecting the decimated fields returned:
+        1 = mean, 2 = min, 4 = max, 8 = standard deviation.
+
+    The data is returned block by block by a.read_extended(), which behaves as
+    for subscription.read_extended() except that the first and last blocks may
+    be short, and None is returned at the end of the data.  For decimated data
+    the waveform has an extra field axis, thus:
+        wf[n, b, f, x] = sample n of BPM b field f on channel x.
+    The total number of samples to be delivered is available as a.samples.
+
+    The remaining options correspond to the read request options: all_data
+    accepts a partially available range, contiguous fails the request on any
+    gap and check_id0 also checks id0 for gaps.
+    '''
+
+    def __init__(self, mask, start, end=None, samples=None, source='F',
+            fields=15, id0=False, all_data=False, contiguous=False,
+            check_id0=False, **kargs):
+        assert (end is None) != (samples is None), \
+            'Must specify exactly one of end or samples'
+        assert source in ['F', 'D', 'DD'], 'Invalid archive source'
+        connection.__init__(self, **kargs)
+        self.count, format = format_mask(mask)
+        self.source = source
+        self.decimated = source != 'F'
+        self.id0 = id0
+
+        request = 'R' + source
+        if self.decimated:
+            self.fields = bin(fields).count('1')
+            self.shape = (self.count, self.fields, 2)
+            if fields != 15:
+                request = request + 'F%d' % fields
+        else:
+            self.shape = (self.count, 2)
+        request = request + 'M' + format + format_time(start)
+        if end is None:
+            request = request + 'N%d' % samples
+        else:
+            request = request + 'E' + format_time(end)
+        request = request + 'N'
+        if all_data: request = request + 'A'
+        request = request + 'TE'
+        if id0: request = request + 'Z'
+        if contiguous:
+            request = request + 'C'
+            if check_id0: request = request + 'Z'
+
+        self.sock.send((request + '\n').encode())
+        self.check_response()
+        self.samples = int(self.read_header(numpy.dtype('<u8')))
+        self.read_stream_header()
+        self.remaining = self.samples
+        self.first = True
+
+    def read_extended(self):
+        '''Reads the next block of data from the archive, returns
+        (timestamp, duration, id0, wf) as for subscription.read_extended(), or
+        None when all the data has been read.'''
+        if self.remaining <= 0:
+            return None
+
+        header = self.read_header(self.header)
+        if self.id0:
+            id0 = int(header['id0'])
+        else:
+            id0 = None
+        samples = self.block_size
+        if self.first:
+            samples -= self.offset
+            self.first = False
+        samples = min(samples, self.remaining)
+        self.remaining -= samples
+
+        raw = self.read_block(4 * samples * numpy.prod(self.shape))
+        array = numpy.frombuffer(raw, dtype = numpy.int32)
+        return (
+            int(header['timestamp']), int(header['duration']), id0,
+            array.reshape((samples,) + self.shape))
+
+    def __iter__(self):
+        while True:
+            block = self.read_extended()
+            if block is None:
+                break
+            yield block
+
 
 def server_command(command, **kargs):
     server = connection(**kargs)
@@ -165,6 +343,11 @@ def get_sample_frequency(**kargs):
 def get_decimation(**kargs):
     return int(server_command('CC\n', **kargs))
 
+def get_archived_ids(**kargs):
+    '''Returns the list of FA ids stored in the archive.'''
+    mask = int(server_command('CM\n', **kargs), 16)
+    return [id for id in range(mask.bit_length()) if mask >> id & 1]
+
 def get_fa_ids(**kargs):
     '''Connects to server to retrieve FA id list, returns a list of 3-tuples
     containing the following fields:
@@ -187,12 +370,18 @@ def get_fa_ids(**kargs):
 class Server:
     '''A simple helper class to gather together the information required to
     identify the requested server and act as a proxy for the useful commands in
-    this module.'''
+    this module.
 
-    def __init__(self, server = DEFAULT_SERVER, port = DEFAULT_PORT):
+    If virtual is given it is a list of virtual id definitions, as described in
+    fa.falib.virtual, and the virtual ids can then be subscribed to and read
+    from the archive as if they were real ids.'''
+
+    def __init__(self, server = DEFAULT_SERVER, port = DEFAULT_PORT,
+            virtual = None):
         self.server = server
         self.port = port
         self.fa_ids = None
+        self.virtual = virtual_ids(virtual or [])
 
         response = self.server_command('CFCK\n').split('\n')
         self.sample_frequency = float(response[0])
@@ -201,13 +390,63 @@ class Server:
             self.fa_id_count = int(response[2])
         except ValueError:
             self.fa_id_count = 256      # If server responds with error message
+        if self.virtual.ids:
+            self.fa_id_count = max(self.fa_id_count, max(self.virtual.ids) + 1)
 
     def server_command(self, command):
         return server_command(command, server = self.server, port = self.port)
 
     def subscription(self, mask, **kargs):
-        return subscription(
-            mask, server = self.server, port = self.port, **kargs)
+        def open_reader(mask):
+            return subscription(
+                mask, server = self.server, port = self.port, **kargs)
+        if self.virtual.selects(mask):
+            return self.virtual.reader(open_reader, mask)
+        else:
+            return open_reader(mask)
+
+    def archive(self, mask, start, **kargs):
+        def open_reader(mask):
+            return archive(
+                mask, start, server = self.server, port = self.port, **kargs)
+        if self.virtual.selects(mask):
+            return self.virtual.reader(open_reader, mask,
+                decimated = kargs.get('source', 'F') != 'F',
+                fields = kargs.get('fields', 15))
+        else:
+            return open_reader(mask)
+
+    def archive_or_none(self, mask, start, end, **kargs):
+        '''As archive() from start to end, but returns None if there is no data
+        in range.  Any other error is raised.'''
+        try:
+            return self.archive(mask, start, end = end, **kargs)
+        except connection.Error:
+            # The server rejects a request with no data in range, which is only
+            # expected if the range lies outside the archive.
+            first, last = self.get_archive_range()
+            if first < end and start < last:
+                raise
+            return None
+
+    def get_archived_ids(self):
+        return get_archived_ids(server = self.server, port = self.port)
+
+    def get_archive_range(self):
+        '''Returns the timestamps of the first and last available blocks in
+        the archive, in seconds in the Unix epoch.'''
+        response = self.server_command('CTU\n').split('\n')
+        return float(response[0]), float(response[1])
+
+    def get_archive_decimations(self):
+        '''Returns the total decimation factors for D and DD data.'''
+        response = self.server_command('CdD\n').split('\n')
+        first = int(response[0])
+        return first, first * int(response[1])
+
+    def get_event_id(self):
+        '''Returns the FA id configured as the event mask, or -1 if none.'''
+        return int(self.server_command('CE\n'))
 
     def get_fa_ids(self, stored = False, missing = False):
         '''Retrieves list of BPM FA ids from server.  If stored is set then the
@@ -215,6 +454,10 @@ class Server:
         names are synthesised where they are missing.'''
         if self.fa_ids is None:
             self.fa_ids = get_fa_ids(server = self.server, port = self.port)
+            # Virtual ids are never archived, but their sources may be.
+            self.fa_ids.extend(
+                (fa_id, name, False)
+                for fa_id, name in zip(self.virtual.ids, self.virtual.names))
 
         if stored:
             # Filter out only the ids which are archived
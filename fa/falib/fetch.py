@@ -0,0 +1,66 @@
+# Parallel archive reads
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# A single archive read of many ids is limited by the rate at which one
+# connection is served, which is well below the rate the archiver can read from
+# disk.  Here the ids are split into groups, each read over its own connection
+# by its own cothread, and the results are joined back together block by
+# block.  As every group reads the same range of the archive, the blocks of all
+# groups have identical headers.
+
+import numpy
+import cothread
+
+from fa.falib.falib import connection
+
+
+__all__ = ['fetch_parallel']
+
+
+def fetch_parallel(server, ids, start, end, connections = 8, **kargs):
+    '''Reads the given ids from start to end from the archive, splitting the
+    ids across up to the given number of concurrent connections.  Any other
+    arguments are passed through to server.archive().  Returns (offset,
+    block_size, blocks), where offset and block_size are as read from the
+    stream header, and blocks is a list of (timestamp, duration, id0, data) as
+    returned by archive.read_extended() with data for all ids in id order.'''
+    ids = sorted(ids)
+    count = max(1, min(connections, len(ids)))
+    groups = [list(map(int, group)) for group in numpy.array_split(ids, count)]
+
+    def fetch(group):
+        reader = server.archive(group, start, end = end, **kargs)
+        try:
+            return reader.offset, reader.block_size, list(reader)
+        finally:
+            reader.close()
+
+    tasks = [cothread.Spawn(fetch, group, raise_on_wait = True)
+        for group in groups]
+    results = [task.Wait() for task in tasks]
+
+    offset, block_size, first = results[0]
+    for other_offset, _, other in results[1:]:
+        if other_offset != offset or len(other) != len(first) or any(
+                a[:2] != b[:2] for a, b in zip(first, other)):
+            raise connection.Error('Inconsistent data from parallel reads')
+    blocks = [
+        header[:3] + (numpy.concatenate(
+            [result[2][n][3] for result in results], axis = 1),)
+        for n, header in enumerate(first)]
+    return offset, block_size, blocks
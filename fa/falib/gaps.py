@@ -0,0 +1,199 @@
+# Streaming continuity checking of FA data streams
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# The C and CZ archive options can only fail an entire request when a gap is
+# found, and live subscriptions report nothing.  Instead we check the extended
+# timestamp (TE and TEZ) block headers as they arrive and record a list of gaps,
+# so that long captures can continue through a gap and annotate it instead.
+#
+# All the checking is done per block rather than per sample, so the cost is
+# independent of the number of subscribed ids.
+
+import collections
+import numpy
+
+
+__all__ = ['continuity', 'checked_blocks', 'gap', 'gap_dtype']
+
+
+# A single discontinuity in the data stream.  The fields are:
+#   sample  Index of the first sample delivered after the gap
+#   start   Expected timestamp of the block following the gap
+#   end     Actual timestamp of the block following the gap
+#   turns   Number of FA turns missing according to id0 (negative if id0 went
+#           backwards), or None if id0 is not being checked.
+# All timestamps are in microseconds in the Unix epoch.
+gap = collections.namedtuple('gap', ['sample', 'start', 'end', 'turns'])
+
+# Equivalent compact representation of a list of gaps, as returned by
+# continuity.gap_array() and saved with captured data.  Missing turns are
+# recorded as 0 when id0 is not checked.
+gap_dtype = numpy.dtype([
+    ('sample', '<i8'), ('start', '<i8'), ('end', '<i8'), ('turns', '<i8')])
+
+ID0_MODULUS = 1 << 32
+
+
+def id0_step(last_id0, id0, block_size):
+    '''Returns the signed number of turns id0 has advanced beyond block_size,
+    allowing for wraparound of the 32 bit counter.'''
+    turns = (id0 - last_id0 - block_size) % ID0_MODULUS
+    return numpy.where(turns >= ID0_MODULUS // 2, turns - ID0_MODULUS, turns)
+
+
+class continuity:
+    '''c = continuity(block_size, offset, check_id0, tolerance)
+
+    Checks the block headers of a data stream delivered with extended
+    timestamps, as returned by subscription.read_extended() or by an archive
+    read with TE or TEZ.  Each header is passed to c.check() as it arrives and
+    any discontinuities are recorded in c.gaps.
+
+    A gap is reported when the timestamp of a block fails to advance or differs
+    from the end of the previous block by more than tolerance times the
+    previous block duration, or if check_id0 is set and id0 does not advance by
+    exactly block_size turns.  The offset is the number of samples omitted
+    from the first block, as reported in the stream header.
+    '''
+
+    def __init__(self, block_size, offset = 0, check_id0 = True,
+            tolerance = 0.5):
+        self.block_size = block_size
+        self.offset = offset
+        self.check_id0 = check_id0
+        self.tolerance = tolerance
+        self.reset()
+
+    def reset(self):
+        self.gaps = []
+        self.blocks = 0
+        self.samples = 0            # Number of samples delivered so far
+        self.last_timestamp = None
+        self.last_duration = None
+        self.last_id0 = None
+
+    def __block_samples(self, blocks):
+        '''Returns the number of samples delivered in each of the next
+        blocks.'''
+        samples = numpy.repeat(self.block_size, blocks)
+        if self.blocks == 0 and blocks:
+            samples[0] -= self.offset
+        return samples
+
+    def check(self, timestamp, duration, id0 = None):
+        '''Checks a single block header against its predecessor, returns the
+        gap detected or None if the stream is continuous.'''
+        result = None
+        if self.last_timestamp is not None:
+            expected = self.last_timestamp + self.last_duration
+            bad = \
+                timestamp <= self.last_timestamp or \
+                abs(timestamp - expected) > \
+                    self.tolerance * self.last_duration
+            turns = None
+            if self.check_id0 and id0 is not None and \
+                    self.last_id0 is not None:
+                turns = int(id0_step(self.last_id0, id0, self.block_size))
+                bad = bad or turns != 0
+            if bad:
+                result = gap(self.samples, expected, timestamp, turns)
+                self.gaps.append(result)
+
+        self.samples += int(self.__block_samples(1)[0])
+        self.blocks += 1
+        self.last_timestamp = timestamp
+        self.last_duration = duration
+        self.last_id0 = id0
+        return result
+
+    def check_blocks(self, timestamps, durations, id0 = None):
+        '''Checks an array of block headers in one pass, for example the
+        timestamp footer returned by a TA archive read.  Returns the list of
+        gaps detected.'''
+        timestamps = numpy.asarray(timestamps, dtype = numpy.int64)
+        durations = numpy.asarray(durations, dtype = numpy.int64)
+        count = len(timestamps)
+        if count == 0:
+            return []
+
+        # Sample index of the start of each block.
+        samples = self.__block_samples(count)
+        starts = self.samples + numpy.cumsum(samples) - samples
+
+        # Compare each block with its predecessor, including the last block we
+        # saw on a previous call.
+        if self.last_timestamp is None:
+            first = 1
+            prev_timestamps = timestamps[:-1]
+            prev_durations = durations[:-1]
+        else:
+            first = 0
+            prev_timestamps = numpy.append(self.last_timestamp, timestamps[:-1])
+            prev_durations = numpy.append(self.last_duration, durations[:-1])
+        expected = prev_timestamps + prev_durations
+        this = timestamps[first:]
+        bad = (this <= prev_timestamps) | \
+            (numpy.abs(this - expected) > self.tolerance * prev_durations)
+
+        # As for check(), id0 is only checked against a known predecessor, and
+        # the previous headers may have been checked without id0.
+        turns = [None] * len(this)
+        if self.check_id0 and id0 is not None:
+            id0 = numpy.asarray(id0, dtype = numpy.int64)
+            if self.last_id0 is None:
+                checked = 1 - first
+                steps = id0_step(id0[:-1], id0[1:], self.block_size)
+            else:
+                checked = 0
+                steps = id0_step(
+                    numpy.append(self.last_id0, id0[:-1]), id0,
+                    self.block_size)
+            turns[checked:] = [int(step) for step in steps]
+            bad[checked:] |= steps != 0
+
+        result = [
+            gap(int(starts[first + ix]), int(expected[ix]), int(this[ix]),
+                turns[ix])
+            for ix in numpy.nonzero(bad)[0]]
+        self.gaps.extend(result)
+
+        self.samples += int(numpy.sum(samples))
+        self.blocks += count
+        self.last_timestamp = int(timestamps[-1])
+        self.last_duration = int(durations[-1])
+        self.last_id0 = None if id0 is None else int(id0[-1])
+        return result
+
+    def gap_array(self):
+        '''Returns the gaps found so far as a numpy array of gap_dtype.'''
+        return numpy.array(
+            [(g.sample, g.start, g.end, g.turns or 0) for g in self.gaps],
+            dtype = gap_dtype)
+
+
+def checked_blocks(sub, checker = None):
+    '''Generator reading blocks from an extended subscription, yields
+        (timestamp, id0, wf, gap)
+    for each block received, where gap is None unless a discontinuity was
+    detected immediately before this block.  A continuity checker can be passed
+    if the accumulated list of gaps is wanted.'''
+    if checker is None:
+        checker = continuity(sub.block_size, sub.offset, sub.id0)
+    while True:
+        timestamp, duration, id0, wf = sub.read_extended()
+        yield (timestamp, id0, wf, checker.check(timestamp, duration, id0))
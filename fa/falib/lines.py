@@ -0,0 +1,137 @@
+# Streaming tracking of spectral lines
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# A small number of fixed frequencies (mains and its harmonics, girder and
+# pump resonances) are of permanent interest, and computing a full FFT per BPM
+# to read off a dozen bins is wasteful.  Instead each line is tracked by a bank
+# of sliding DFT filters, equivalent to a Goertzel filter per line and channel
+# but with an exponentially decaying window so that results are available
+# continuously.
+#
+# Each channel is mixed down by each line frequency and passed through two
+# cascaded single pole integrators, giving an effective window of (k+1)*d^k
+# over the last k samples.  BPM positions have a large DC component, so the
+# first sample is subtracted from all data as a reference, and the second pole
+# reduces leakage from what remains to well below the line amplitudes of
+# interest.
+#
+# For a block of N samples the update of every filter is a single matrix
+# product of a (4*lines, N) table of weighted oscillator values with the
+# (N, channels) block of data, so the cost is O(ids * lines) per sample and the
+# work is done by BLAS.
+
+import numpy
+
+
+__all__ = ['line_bank']
+
+
+class line_bank:
+    '''b = line_bank(frequencies, f_s, shape=(2,), time_constant=1)
+
+    Tracks the amplitude and phase of the given list of frequencies (in Hz) in
+    a stream of data sampled at f_s.  Each sample has the given shape, for
+    example (ids, 2) for a subscription to several ids.  The time constant in
+    seconds determines the width of the window over which lines are measured.
+
+    Blocks of data indexed by sample are passed to b.update(), after which the
+    current line amplitudes and phases are available as b.amplitude and
+    b.phase, both of shape (lines,) + shape.  Amplitudes are peak amplitudes in
+    the units of the data, and phases are in radians relative to a common
+    oscillator for all channels, so relative phases between channels are
+    meaningful.'''
+
+    # Maximum number of block length tables we cache.
+    MAX_TABLES = 4
+
+    def __init__(self, frequencies, f_s, shape = (2,), time_constant = 1):
+        self.frequencies = numpy.array(frequencies, dtype = numpy.float64)
+        self.f_s = f_s
+        self.shape = tuple(shape)
+        self.omega = 2 * numpy.pi * self.frequencies / f_s
+        self.decay = numpy.exp(-1. / (time_constant * f_s))
+        self.tables = {}
+        self.reset()
+
+    def reset(self):
+        lines = len(self.frequencies)
+        channels = int(numpy.prod(self.shape))
+        self.state1 = numpy.zeros((lines, channels), numpy.complex128)
+        self.state2 = numpy.zeros((lines, channels), numpy.complex128)
+        self.weight1 = 0.
+        self.weight2 = 0.
+        # Phase of each line oscillator at the start of the next block.
+        self.oscillator = numpy.zeros(lines)
+        self.reference = None
+
+    def __table(self, length):
+        '''Returns the table of weighted oscillators for a block of the given
+        length, stacked as real and imaginary parts for both integrators, and
+        the corresponding weights.'''
+        try:
+            return self.tables[length]
+        except KeyError:
+            pass
+        n = numpy.arange(length)
+        weight1 = self.decay ** (length - 1 - n)
+        weight2 = (length - n) * weight1
+        phase = self.omega[:, None] * n[None, :]
+        cos = numpy.cos(phase)
+        sin = -numpy.sin(phase)
+        table = numpy.concatenate([
+            weight1 * cos, weight1 * sin, weight2 * cos, weight2 * sin])
+        if len(self.tables) >= self.MAX_TABLES:
+            self.tables.clear()
+        self.tables[length] = (table, weight1.sum(), weight2.sum())
+        return self.tables[length]
+
+    def update(self, block):
+        '''Updates the filters with a block of data.'''
+        length = len(block)
+        if length == 0:
+            return
+        block = block.reshape(length, -1)
+        if self.reference is None:
+            self.reference = numpy.float64(block[0])
+        table, sum1, sum2 = self.__table(length)
+        lines = len(self.frequencies)
+        result = numpy.dot(table, block - self.reference)
+        rotation = numpy.exp(-1j * self.oscillator)[:, None]
+        block1 = rotation * (result[:lines] + 1j * result[lines:2*lines])
+        block2 = rotation * (result[2*lines:3*lines] + 1j * result[3*lines:])
+
+        # Advance the cascaded integrators over the block.
+        scale = self.decay ** length
+        self.state2 = scale * (self.state2 + length * self.state1) + block2
+        self.state1 = scale * self.state1 + block1
+        self.weight2 = scale * (self.weight2 + length * self.weight1) + sum2
+        self.weight1 = scale * self.weight1 + sum1
+
+        self.oscillator = \
+            (self.oscillator + length * self.omega) % (2 * numpy.pi)
+
+    @property
+    def amplitude(self):
+        weight = self.weight2 or 1
+        return (2 / weight * numpy.abs(self.state2)).reshape(
+            (len(self.frequencies),) + self.shape)
+
+    @property
+    def phase(self):
+        return numpy.angle(self.state2).reshape(
+            (len(self.frequencies),) + self.shape)
@@ -0,0 +1,144 @@
+# Streaming covariance and principal components of orbit motion
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# The motion of the orbit across the whole ring is dominated by a handful of
+# patterns, the eigenvectors of the covariance matrix of all BPM positions.
+# Rather than capturing data and taking its SVD offline, the covariance of all
+# 2N channels (X and Y of N ids) is accumulated as data arrives and its leading
+# eigenvectors are tracked as it changes.
+#
+# Statistics are carried as count, mean and M2, as for the variance tables, but
+# with M2 now the 2N x 2N matrix of summed products of deviations from the
+# mean.  Each block is folded in with a single BLAS symmetric rank-k update
+# (dsyrk) of its centred samples, which only computes the upper triangle, plus
+# a rank one correction for the difference between the block and running
+# means.
+#
+# Only the leading few eigenvectors are wanted, and they change little from one
+# update to the next, so instead of a full eigendecomposition each update runs
+# a couple of steps of subspace iteration started from the previous
+# eigenvectors, followed by a Rayleigh-Ritz step to separate the modes within
+# the subspace.  Each step costs one (2N x 2N) by (2N x k) product.
+
+import numpy
+from scipy.linalg import blas
+
+
+__all__ = ['orbit_pca']
+
+
+class orbit_pca:
+    '''p = orbit_pca(ids, modes=8, time_constant=None)
+
+    Accumulates the covariance of X and Y of the given list of FA ids, and
+    tracks its leading eigenvectors, the given number of modes.  Blocks of full
+    rate data indexed by sample, id and X/Y are added with p.update(block).  If
+    time_constant is given, in samples, older data is forgotten exponentially,
+    otherwise all data since the last p.reset() is weighted equally.
+
+    p.update_modes() refreshes the modes, after which p.values holds the
+    variance of each mode in decreasing order and p.vectors the normalised
+    modes indexed by mode, id and X/Y.'''
+
+    def __init__(self, ids, modes = 8, time_constant = None):
+        self.ids = list(ids)
+        self.modes = modes
+        self.time_constant = time_constant
+        self.channels = 2 * len(self.ids)
+        assert modes <= self.channels, 'Too many modes for ids'
+        self.reset()
+
+    def reset(self):
+        self.count = 0.
+        self.mean = numpy.zeros(self.channels)
+        # Only the upper triangle of m2 is maintained, and dsyrk wants it in
+        # Fortran order to update it in place.
+        self.m2 = numpy.zeros((self.channels, self.channels), order = 'F')
+        # Start the subspace iteration from a random basis.
+        basis = numpy.random.default_rng(0).standard_normal(
+            (self.channels, self.modes))
+        self.basis, _ = numpy.linalg.qr(basis)
+        self.values = numpy.zeros(self.modes)
+        self.vectors = self.__shape(self.basis)
+
+    def __shape(self, basis):
+        return basis.T.reshape((self.modes, len(self.ids), 2))
+
+    def update(self, block):
+        '''Adds a block of data indexed by sample, id and X/Y.'''
+        n = len(block)
+        if n == 0:
+            return
+        block = numpy.float64(block).reshape((n, self.channels))
+        mean = block.mean(axis = 0)
+        centred = block - mean
+
+        if self.time_constant:
+            decay = numpy.exp(-n / self.time_constant)
+            self.count *= decay
+            self.m2 *= decay
+
+        # Symmetric rank-k update of the upper triangle with this block.  The
+        # transpose of centred is in Fortran order, so isn't copied.
+        self.m2 = blas.dsyrk(1.0, centred.T, beta = 1.0, c = self.m2,
+            trans = 0, lower = 0, overwrite_c = 1)
+        total = self.count + n
+        delta = mean - self.mean
+        self.m2 += numpy.outer(delta, delta * (self.count * n / total))
+        self.mean += delta * (n / total)
+        self.count = total
+
+    def covariance(self):
+        '''Returns the full 2N x 2N covariance matrix, channels ordered as X
+        and Y of each id in turn.'''
+        upper = numpy.triu(self.m2)
+        return (upper + numpy.triu(upper, 1).T) / max(self.count, 1)
+
+    def total_variance(self):
+        '''Returns the sum of the variances of all channels, the sum of all the
+        eigenvalues of the covariance.'''
+        return numpy.trace(self.m2) / max(self.count, 1)
+
+    def update_modes(self, iterations = 2):
+        '''Refines the leading modes from the current covariance with the given
+        number of steps of subspace iteration.'''
+        covariance = self.covariance()
+        basis = self.basis
+        for n in range(iterations):
+            basis, _ = numpy.linalg.qr(numpy.dot(covariance, basis))
+
+        # Rayleigh-Ritz: diagonalise the covariance within the subspace.
+        values, rotation = numpy.linalg.eigh(
+            numpy.dot(basis.T, numpy.dot(covariance, basis)))
+        order = numpy.argsort(values)[::-1]
+        values = values[order]
+        basis = numpy.dot(basis, rotation[:, order])
+
+        # Keep the sign of each mode consistent with the previous update, so
+        # that amplitudes don't flip from one update to the next.
+        signs = numpy.sign(numpy.sum(basis * self.basis, axis = 0))
+        signs[signs == 0] = 1
+        self.basis = basis * signs
+        self.values = numpy.maximum(values, 0)
+        self.vectors = self.__shape(self.basis)
+
+    def amplitudes(self, block):
+        '''Returns the amplitude of each mode for each sample of a block of
+        data indexed by sample, id and X/Y.'''
+        block = numpy.float64(block).reshape((len(block), self.channels))
+        return numpy.dot(block - self.mean, self.basis)
@@ -0,0 +1,255 @@
+# Coarse to fine search of the archive for beam excursions
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# The min and max fields of decimated data bound every full rate sample they
+# summarise, so a decimated sample whose min and max lie within a threshold of
+# the beam position rules out any full rate sample beyond it.  An excursion
+# search therefore reads the min and max of DD data for the whole search range,
+# reads D data only for the DD samples which might hold an excursion, and reads
+# full rate data only around the D samples which certainly do, to find where
+# each excursion starts and ends.  For rare excursions this reads a tiny
+# fraction of the full rate data in the range.
+#
+# An excursion is measured from the beam position before it starts, taken as
+# the mean of the DD means over the preceding baseline period.
+
+import numpy
+
+
+__all__ = ['read_blocks', 'excursion', 'excursion_search']
+
+
+def read_blocks(server, ids, start, end, source = 'F', fields = 15):
+    '''Reads the given ids from start to end from the archive, yielding (times,
+    data) for each block read, where times are the sample times in seconds and
+    data is as returned by archive.read_extended().  Gaps in the archive are
+    skipped and nothing is returned if there is no data in range.  Any other
+    error from the server is raised.'''
+    reader = server.archive_or_none(ids, start, end,
+        source = source, fields = fields, all_data = True)
+    if reader is None:
+        return
+    try:
+        offset = reader.offset
+        for timestamp, duration, _, data in reader:
+            interval = duration / reader.block_size
+            yield 1e-6 * (timestamp + interval * (
+                offset + numpy.arange(len(data)))), data
+            offset = 0
+    finally:
+        reader.close()
+
+
+def deviation(low, high, baseline):
+    '''Returns the largest deviation of min and max from baseline, all indexed
+    by id and X/Y with an optional leading sample axis.'''
+    return numpy.maximum(high - baseline, baseline - low)
+
+
+class excursion:
+    '''Describes one excursion found by excursion_search().  start and end are
+    the times in seconds of the first and last samples beyond the threshold,
+    peak is the largest deviation from baseline, fa_id and axis (0 for X, 1 for
+    Y) where it was seen, and ids lists all ids which crossed the threshold.
+    source is the finest data examined, 'F' unless the excursion was too long
+    for full rate data to be read.'''
+
+    def __init__(self, start, end, peak, fa_id, axis, ids, source):
+        self.start = start
+        self.end = end
+        self.peak = peak
+        self.fa_id = fa_id
+        self.axis = axis
+        self.ids = ids
+        self.source = source
+
+    def __repr__(self):
+        return 'excursion(%.6f, %.6f, %g, %d, %d, %s, %s)' % (
+            self.start, self.end, self.peak, self.fa_id, self.axis,
+            self.ids, self.source)
+
+
+class interval_builder:
+    '''Merges the times of samples in which ids cross the threshold into
+    intervals, starting a new interval whenever there are more than gap seconds
+    between the end of one sample and the start of the next, where each sample
+    lasts interval seconds.  Each interval records the baseline of each of its
+    ids at its first crossing.'''
+
+    def __init__(self, ids, gap, interval):
+        self.ids = numpy.array(ids)
+        self.gap = gap + interval
+        self.intervals = []     # List of (start, end, {id: baseline})
+        self.current = None
+
+    def add(self, times, hits, baselines):
+        '''Adds samples where any id crossed, hits is indexed by sample and id
+        and baselines by sample, id and X/Y.'''
+        for time, hit, baseline in zip(times, hits, baselines):
+            if self.current is None or time - self.current[1] > self.gap:
+                self.finish()
+                self.current = [time, time, {}]
+            self.current[1] = time
+            found = self.current[2]
+            for n in numpy.nonzero(hit)[0]:
+                found.setdefault(int(self.ids[n]), baseline[n])
+
+    def finish(self):
+        if self.current is not None:
+            self.intervals.append(tuple(self.current))
+            self.current = None
+        return self.intervals
+
+
+class excursion_search:
+    '''s = excursion_search(server, ids, start, end, threshold, ...)
+
+    Searches the archive from start to end for every excursion of any of the
+    given FA ids beyond threshold from its baseline position, in archive
+    units (nm).  The found excursions are in s.excursions, ranked by peak
+    deviation, and s.bytes_read and s.fraction report how much data was read
+    from the archive, the latter as a fraction of the full rate data in range.
+
+    The optional arguments are:
+        baseline    Seconds of DD data averaged for the baseline, default 60
+        gap         Crossings separated by less than gap seconds are merged
+                    into one excursion, default 1
+        margin      Seconds of full rate data read either side of each
+                    excursion, default 0.01
+        max_window  Excursions longer than this many seconds are only
+                    resolved with D data, default 10
+        progress    Called with a message as each stage starts
+    '''
+
+    def __init__(self, server, ids, start, end, threshold,
+            baseline = 60, gap = 1, margin = 0.01, max_window = 10,
+            progress = lambda message: None):
+        self.server = server
+        self.ids = sorted(ids)
+        self.threshold = threshold
+        self.gap = gap
+        self.margin = margin
+        self.max_window = max_window
+        self.bytes_read = 0
+        f_s = server.sample_frequency
+        self.d, self.dd = server.get_archive_decimations()
+
+        progress('Scanning DD data')
+        candidates = self.scan_dd(start, end, max(1, int(
+            round(baseline * f_s / self.dd))))
+        progress('Checking %d candidates with D data' % len(candidates))
+        events = []
+        for candidate in candidates:
+            events.extend(self.scan_d(*candidate))
+        progress('Resolving %d excursions with full rate data' % len(events))
+        self.excursions = [self.resolve(*event) for event in events]
+        self.excursions = [e for e in self.excursions if e is not None]
+        self.excursions.sort(key = lambda e: e.peak, reverse = True)
+
+        full_bytes = (end - start) * f_s * len(self.ids) * 8
+        self.fraction = self.bytes_read / full_bytes
+
+
+    def read(self, ids, start, end, source, fields):
+        for times, data in read_blocks(
+                self.server, ids, start, end, source, fields):
+            self.bytes_read += data.nbytes
+            yield times, data
+
+    def scan_dd(self, start, end, window):
+        '''Reads DD mean, min and max for all ids, returns candidate intervals
+        as a list of (start, end, {id: baseline}).  The baseline is the mean of
+        the window DD means before each sample.'''
+        dd_interval = self.dd / self.server.sample_frequency
+        builder = interval_builder(self.ids, self.gap, dd_interval)
+        history = numpy.zeros((0, len(self.ids), 2))
+        for times, data in self.read(self.ids, start, end, 'DD', 7):
+            data = numpy.float64(data)
+            means = numpy.concatenate((history, data[:, :, 0]))
+            sums = numpy.concatenate((
+                numpy.zeros((1,) + means.shape[1:]),
+                numpy.cumsum(means, axis = 0)))
+            # Sample n of this block is sample n + len(history) of means.
+            ends = len(history) + numpy.arange(len(data))
+            starts = numpy.maximum(ends - window, 0)
+            counts = (ends - starts)[:, None, None]
+            with numpy.errstate(invalid = 'ignore', divide = 'ignore'):
+                baselines = (sums[ends] - sums[starts]) / counts
+            # Until we have any history use each sample's own mean.
+            baselines = numpy.where(counts > 0, baselines, data[:, :, 0])
+            history = means[-window:]
+
+            excess = deviation(data[:, :, 1], data[:, :, 2], baselines)
+            hits = numpy.any(excess > self.threshold, axis = 2)
+            some = numpy.any(hits, axis = 1)
+            builder.add(times[some], hits[some], baselines[some])
+        return [(low, high + dd_interval, found)
+            for low, high, found in builder.finish()]
+
+    def scan_d(self, start, end, found):
+        '''Reads D min and max for the ids found in one candidate interval,
+        returns the excursions as (start, end, {id: baseline}).'''
+        ids = sorted(found)
+        baseline = numpy.array([found[id] for id in ids])
+        d_interval = self.d / self.server.sample_frequency
+        builder = interval_builder(ids, self.gap, d_interval)
+        for times, data in self.read(ids, start, end, 'D', 6):
+            data = numpy.float64(data)
+            excess = deviation(data[:, :, 0], data[:, :, 1], baseline)
+            hits = numpy.any(excess > self.threshold, axis = 2)
+            some = numpy.any(hits, axis = 1)
+            builder.add(times[some], hits[some],
+                numpy.broadcast_to(baseline, (some.sum(),) + baseline.shape))
+        return [(low, high + d_interval, found)
+            for low, high, found in builder.finish()]
+
+    def resolve(self, start, end, found):
+        '''Reads full rate data around one excursion, returns an excursion or
+        None if nothing crossed the threshold after all.'''
+        ids = sorted(found)
+        baseline = numpy.array([found[id] for id in ids])
+        source = 'F'
+        if end - start > self.max_window:
+            # Too long to be worth reading at full rate, just look at the
+            # start of the excursion at full rate and keep the D end time.
+            source = 'D'
+            read_end = start + self.max_window
+        else:
+            read_end = end
+        first = last = None
+        peak = -numpy.inf
+        for times, data in self.read(ids,
+                start - self.margin, read_end + self.margin, 'F', 15):
+            excess = numpy.abs(data - baseline)
+            hits = numpy.nonzero(numpy.any(excess > self.threshold,
+                axis = (1, 2)))[0]
+            if len(hits):
+                if first is None:
+                    first = times[hits[0]]
+                last = times[hits[-1]]
+            n, id, axis = numpy.unravel_index(
+                numpy.argmax(excess), excess.shape)
+            if excess[n, id, axis] > peak:
+                peak = float(excess[n, id, axis])
+                peak_id, peak_axis = ids[id], int(axis)
+        if first is None:
+            return None
+        if source == 'D':
+            last = end
+        # Every id found in D data certainly crossed at full rate.
+        return excursion(first, last, peak, peak_id, peak_axis, ids, source)
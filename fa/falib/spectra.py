@@ -0,0 +1,289 @@
+# Spectra and band limited RMS motion
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# The FFT scaling used by the viewer, shared here so that headless tools report
+# the same numbers as the viewer displays.
+#
+# The RMS motion in a frequency band is the square root of the power spectral
+# density integrated over the band, exactly as the viewer's integrated mode
+# computes it.  For the whole ring this is done as one batched FFT along the
+# time axis of a (samples, ids, 2) block, optionally averaging the power of
+# several shorter segments to trade frequency resolution for a steadier result.
+# The FFT length is rounded down to a product of small primes: one second at
+# 10072 Hz is 8 * 1259 samples, which transforms several times slower than the
+# 10000 samples actually used.
+#
+# Results are kept in a rolling table in a memory mapped .npy file, one row per
+# update, in the same way as the variance tables.
+#
+# The viewer's logarithmic frequency modes condense spectra into bins of
+# logarithmically growing width, and the same condensing is used here to
+# compute the integrated motion of averaged spectra of longer stretches of
+# archived data, with a single numpy reduction over all ids at once.
+
+import os
+import numpy
+from numpy.lib.format import open_memmap
+
+
+__all__ = [
+    'scaled_abs_fft', 'fast_length', 'fft_timebase', 'compute_gaps',
+    'condense', 'averaged_power', 'integrated_motion',
+    'band_rms', 'band_table']
+
+
+# Default number of logarithmic frequency points, as shown by the viewer.
+LOGF_POINTS = 5000
+
+
+def scaled_abs_fft(value, sample_frequency, windowed=False, axis=0):
+    '''Returns the fft of value along the given axis scaled so that values are
+    in units per sqrt(Hz).  The magnitude of the first half of the spectrum is
+    returned.'''
+    N = value.shape[axis]
+    if windowed:
+        # The Hann window is good enough.  In some cases the Hamming window
+        # looks a bit better, but then I'd need a choice of windows.  Not really
+        # the point here, so just go for the simplest...
+        window = 1 + numpy.cos(numpy.linspace(-numpy.pi, numpy.pi, N))
+        shape = [1] * value.ndim
+        shape[axis] = N
+        value = value * window.reshape(shape)
+    # Our data is real, so only half the spectrum need be computed.
+    fft = numpy.fft.rfft(value, axis=axis)
+
+    # This trickery below is simply implementing fft[:N//2] where the slicing is
+    # along the specified axis rather than axis 0.  It does seem a bit
+    # complicated...
+    slice = [numpy.s_[:] for s in fft.shape]
+    slice[axis] = numpy.s_[:N//2]
+    fft = fft[tuple(slice)]
+
+    # Finally scale the result into units per sqrt(Hz)
+    return numpy.abs(fft) * numpy.sqrt(2.0 / (sample_frequency * N))
+
+def fast_length(n):
+    '''Returns the largest product of powers of 2, 3 and 5 no larger than n.'''
+    best = 1
+    p5 = 1
+    while p5 <= n:
+        p3 = p5
+        while p3 <= n:
+            p2 = p3
+            while 2 * p2 <= n:
+                p2 *= 2
+            best = max(best, p2)
+            p3 *= 3
+        p5 *= 5
+    return best
+
+def fft_timebase(sample_count, sample_frequency, scale=1.0):
+    '''Returns a waveform suitable for an FFT timebase with the given number of
+    points.'''
+    return scale * sample_frequency * \
+        numpy.arange(sample_count // 2) / sample_count
+
+def compute_gaps(l, N):
+    '''This computes a series of logarithmically spaced indexes into an array
+    of length l.  N is a hint for the number of indexes, but the result may
+    be somewhat shorter.'''
+    gaps = numpy.int_(numpy.logspace(0, numpy.log10(l), N))
+    counts = numpy.diff(gaps)
+    return counts[counts > 0]
+
+def condense(value, counts):
+    '''The given waveform is condensed in logarithmic intervals so that the same
+    number of points are generated in each decade.  The sum over each interval
+    is returned, the same shape as value in all axes except the first.'''
+    starts = numpy.cumsum(counts) - counts
+    total = starts[-1] + counts[-1]
+    return numpy.add.reduceat(value[:total], starts, axis = 0)
+
+def integrated_motion(power, f_s, length, points = LOGF_POINTS):
+    '''Condenses a power spectral density, as returned by
+    averaged_power.power() for segments of the given length, onto
+    logarithmically spaced frequencies as for the viewer's integrated mode.
+    Returns (frequencies, spectrum, integrated), where spectrum is the mean
+    density over each interval and integrated is the cumulative RMS motion up
+    to each frequency.'''
+    counts = compute_gaps(length // 2 - 1, points)[1:]
+    frequencies = f_s * (numpy.cumsum(counts) + 1) / length
+    sums = condense(power[2:], counts)
+    shape = (-1,) + (1,) * (power.ndim - 1)
+    spectrum = sums / counts.reshape(shape)
+    integrated = numpy.sqrt(f_s / length * numpy.cumsum(sums, axis = 0))
+    return frequencies, spectrum, integrated
+
+
+class averaged_power:
+    '''p = averaged_power(f_s, length, windowed=False)
+
+    Accumulates the power spectral density of data indexed by sample along its
+    first axis, averaged over back to back segments of the given length.  Data
+    is added block by block with p.update(block), samples short of a complete
+    segment being kept for the next block, so a long range of data never need
+    be held at once.  p.power() returns the square of scaled_abs_fft() averaged
+    over the segments so far, with each segment transformed for all the
+    remaining axes at once.'''
+
+    def __init__(self, f_s, length, windowed = False):
+        self.f_s = f_s
+        self.length = length
+        self.windowed = windowed
+        self.total = 0
+        self.segments = 0
+        self.blocks = []
+        self.count = 0
+
+    def update(self, block):
+        self.blocks.append(block)
+        self.count += len(block)
+        if self.count < self.length:
+            return
+
+        if len(self.blocks) == 1:
+            data = block
+        else:
+            data = numpy.concatenate(self.blocks)
+        segments = len(data) // self.length
+        for n in range(segments):
+            segment = numpy.float64(
+                data[n * self.length:(n + 1) * self.length])
+            segment -= segment.mean(axis = 0)
+            self.total = self.total + scaled_abs_fft(
+                segment, self.f_s, windowed = self.windowed)**2
+        self.segments += segments
+        # Keep only a copy of the remainder, not the whole of data.
+        rest = numpy.array(data[segments * self.length:])
+        self.blocks = [rest]
+        self.count = len(rest)
+
+    def power(self):
+        if self.segments == 0:
+            raise ValueError('Need at least %d samples' % self.length)
+        power = self.total / self.segments
+        if self.windowed:
+            # Undo the loss of power in the window, as for band_rms.
+            window = 1 + numpy.cos(
+                numpy.linspace(-numpy.pi, numpy.pi, self.length))
+            power = power / numpy.mean(window**2)
+        return power
+
+
+class band_rms:
+    '''b = band_rms(f_s, samples, bands, segments=1, windowed=True)
+
+    Computes the RMS motion in each of the given bands, a list of (low, high)
+    frequencies in Hz, over blocks of the given number of samples at sample
+    frequency f_s.  Each block is split into the given number of segments and
+    the power of their FFTs averaged, so the frequency resolution is close to
+    f_s * segments / samples.  Each segment is shortened to the nearest fast
+    FFT length.  A frequency bin belongs to a band when low <= f < high.'''
+
+    def __init__(self, f_s, samples, bands, segments = 1, windowed = True):
+        self.f_s = f_s
+        self.samples = samples
+        self.bands = list(bands)
+        self.segments = segments
+        self.windowed = windowed
+        self.length = fast_length(samples // segments)
+        if self.length < 2:
+            raise ValueError('Too many segments for %d samples' % samples)
+
+        f = fft_timebase(self.length, f_s)
+        self.weights = numpy.array([
+            (low <= f) & (f < high) & (f > 0) for low, high in self.bands],
+            dtype = numpy.float64)
+        # Summing |fft|^2 over a band with the viewer's scaling gives the
+        # density, which is integrated over bins of width f_s / length.  A
+        # window scales the total power by its mean square, which is undone.
+        self.scale = f_s / self.length
+        if windowed:
+            window = 1 + numpy.cos(
+                numpy.linspace(-numpy.pi, numpy.pi, self.length))
+            self.scale /= numpy.mean(window**2)
+
+    def compute(self, data):
+        '''Returns the RMS motion in each band for a block of data of at least
+        samples samples along its first axis, shaped (bands,) followed by the
+        remaining axes of data.'''
+        shape = data.shape[1:]
+        step = self.samples // self.segments
+        data = numpy.float64(data[:self.segments * step]).reshape(
+            (self.segments, step) + shape)[:, :self.length]
+        data -= data.mean(axis = 1, keepdims = True)
+        fft = scaled_abs_fft(
+            data, self.f_s, windowed = self.windowed, axis = 1)
+        power = numpy.mean(fft**2, axis = 0)
+        return numpy.sqrt(
+            self.scale * numpy.tensordot(self.weights, power, axes = 1))
+
+
+class band_table:
+    '''t = band_table(directory, ids, bands, rows)
+
+    Rolling table of band RMS results for the given FA ids and list of bands,
+    keeping the most recent rows updates.  The table is stored in rms.npy in
+    the given directory, with the ids and bands it holds in ids.npy and
+    bands.npy, and is created if necessary.  Each row holds the start time of
+    the update in seconds and the RMS motion indexed by band, id and X/Y, in
+    archive units.'''
+
+    def __init__(self, directory, ids, bands, rows):
+        ids = numpy.array(ids)
+        bands = numpy.array(bands, dtype = numpy.float64)
+        if not os.path.isdir(directory):
+            os.makedirs(directory)
+        for name, value in [('ids', ids), ('bands', bands)]:
+            filename = os.path.join(directory, name + '.npy')
+            if os.path.exists(filename):
+                if not numpy.array_equal(numpy.load(filename), value):
+                    raise ValueError(
+                        '%s in %s do not match' % (name, directory))
+            else:
+                numpy.save(filename, value)
+
+        dtype = numpy.dtype([
+            ('time', '<f8'), ('rms', '<f4', (len(bands), len(ids), 2))])
+        filename = os.path.join(directory, 'rms.npy')
+        if os.path.exists(filename):
+            self.table = open_memmap(filename, mode = 'r+')
+            if self.table.dtype != dtype or len(self.table) != rows:
+                raise ValueError('Table %s has the wrong layout' % filename)
+            # Carry on after the most recent row.
+            self.next = (int(numpy.argmax(self.table['time'])) + 1) % rows
+        else:
+            self.table = open_memmap(
+                filename, mode = 'w+', dtype = dtype, shape = (rows,))
+            self.table['time'] = -1
+            self.next = 0
+
+    def add(self, time, rms):
+        row = self.table[self.next]
+        row['time'] = time
+        row['rms'] = rms
+        self.next = (self.next + 1) % len(self.table)
+
+    def read(self):
+        '''Returns (times, rms) for all rows held in time order.'''
+        valid = self.table[self.table['time'] >= 0]
+        valid = valid[numpy.argsort(valid['time'])]
+        return valid['time'], valid['rms']
+
+    def flush(self):
+        self.table.flush()
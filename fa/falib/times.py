@@ -0,0 +1,123 @@
+# Parsing of capture times and durations
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Start times for historical data are specified in the same three ways as for
+# fa-capture(1):
+#   -s yyyy-mm-ddThh:mm:ss[.us][Z]  absolute date and time, UTC if Z given
+#   -t hh:mm:ss[Y]                  time today, or yesterday if Y given
+#   -b hh:mm:ss                     time ago
+# Each can be given as a range of two times separated by ~.  All times are
+# returned in seconds in the Unix epoch.
+
+import re
+import time
+import calendar
+import datetime
+
+
+__all__ = [
+    'parse_time', 'parse_time_range', 'parse_samples', 'add_time_options']
+
+
+def parse_hms(value):
+    '''Parses hh:mm:ss into a number of seconds.'''
+    match = re.match(r'^(\d+):(\d\d):(\d\d(?:\.\d*)?)$', value)
+    if not match:
+        raise ValueError('Invalid time: %s' % value)
+    h, m, s = match.groups()
+    return 3600 * int(h) + 60 * int(m) + float(s)
+
+def parse_datetime(value):
+    match = re.match(
+        r'^(\d{4}-\d\d-\d\dT\d\d:\d\d:\d\d)(\.\d*)?(Z?)$', value)
+    if not match:
+        raise ValueError('Invalid date and time: %s' % value)
+    date, fraction, utc = match.groups()
+    parsed = time.strptime(date, '%Y-%m-%dT%H:%M:%S')
+    if utc:
+        seconds = calendar.timegm(parsed)
+    else:
+        seconds = time.mktime(parsed)
+    if fraction and fraction != '.':
+        seconds += float(fraction)
+    return seconds
+
+def parse_time_of_day(value):
+    yesterday = value.endswith('Y')
+    if yesterday:
+        value = value[:-1]
+    day = datetime.date.today()
+    if yesterday:
+        day -= datetime.timedelta(days = 1)
+    return time.mktime(day.timetuple()) + parse_hms(value)
+
+def parse_time_ago(value):
+    return time.time() - parse_hms(value)
+
+Parsers = {
+    's': parse_datetime,
+    't': parse_time_of_day,
+    'b': parse_time_ago,
+}
+
+
+def parse_time(option, value):
+    '''Parses a single time in the format selected by option, one of 's', 't'
+    or 'b', returning the time in seconds in the Unix epoch.'''
+    return Parsers[option](value)
+
+def parse_time_range(option, value):
+    '''Parses a start time or time range, returns (start, end) where end is None
+    if no range was given.'''
+    times = value.split('~')
+    if len(times) > 2:
+        raise ValueError('Invalid time range: %s' % value)
+    start = parse_time(option, times[0])
+    if len(times) == 2:
+        end = parse_time(option, times[1])
+        if end <= start:
+            raise ValueError('Time range is empty: %s' % value)
+        return start, end
+    else:
+        return start, None
+
+def set_start(option, opt, value, parser):
+    if parser.values.start is not None:
+        parser.error('Only one start time can be specified')
+    parser.values.start = (opt[1], value)
+
+def add_time_options(parser):
+    '''Adds the -s, -t and -b start time options to an optparse parser.  The
+    selected option and its value are stored as options.start, ready for
+    parse_time_range(*options.start), or None if no start time was given.'''
+    parser.set_defaults(start = None)
+    for flag, help in [
+            ('-s', 'Start date and time yyyy-mm-ddThh:mm:ss[.us][Z]'),
+            ('-t', 'Start time today hh:mm:ss[Y], Y for yesterday'),
+            ('-b', 'Start time ago hh:mm:ss')]:
+        parser.add_option(flag, type = 'string', action = 'callback',
+            callback = set_start,
+            help = help + ', or range of times separated by ~')
+
+def parse_samples(value, sample_frequency):
+    '''Parses a sample count, optionally followed by s to specify a duration in
+    seconds at the given sample frequency.'''
+    if value.endswith('s'):
+        return int(round(float(value[:-1]) * sample_frequency))
+    else:
+        return int(value)
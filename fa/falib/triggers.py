@@ -0,0 +1,200 @@
+# Triggered snapshot capture from live data
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# A trigger checks each block of a live full rate subscription as a whole:
+# every condition is a single array comparison over the block, and only the
+# first firing sample is located and described.  The pre-trigger history is the
+# list of the most recently received blocks, which are kept as delivered, so
+# holding history costs no copying at all.  When the trigger fires, the blocks
+# covering the pre-trigger window and the following post-trigger blocks are
+# gathered into a snapshot, which is handed on complete for writing.
+
+import collections
+import numpy
+
+
+__all__ = ['trigger', 'snapshot', 'snapshot_capture']
+
+
+class trigger:
+    '''t = trigger(ids, low=None, high=None, slew=None, event=None, mask=0)
+
+    Checks blocks of full rate data for the given list of ids, as returned by
+    subscription.read(), for any of the following conditions, all in archive
+    units (nm):
+        low, high   A position below low or above high, each either a single
+                    value or an array indexed by id and X/Y
+        slew        A change between successive samples larger than slew, a
+                    single value or an array indexed by id and X/Y
+        event       The event mask FA id, one of ids, which fires the trigger
+                    whenever its X word has any bit of mask set
+    Conditions which are None are not checked, and limits can be set to inf
+    for individual ids and planes.  Position limits are not applied to the
+    event mask id.'''
+
+    def __init__(self, ids, low = None, high = None, slew = None,
+            event = None, mask = 0):
+        self.ids = list(ids)
+        shape = (len(self.ids), 2)
+        if event is None or not mask:
+            self.event = None
+        else:
+            self.event = self.ids.index(event)
+        self.mask = numpy.uint32(mask)
+        def limit(value, disabled):
+            if value is None:
+                return None
+            else:
+                value = numpy.array(numpy.broadcast_to(value, shape), float)
+                # Position limits don't apply to the event mask.
+                if self.event is not None:
+                    value[self.event] = disabled
+                return value
+        self.low = limit(low, -numpy.inf)
+        self.high = limit(high, numpy.inf)
+        self.slew = limit(slew, numpy.inf)
+        self.last = None
+
+    def check(self, block):
+        '''Checks a block, returns (sample, reason) for the first sample to fire
+        the trigger, or None.'''
+        fired = numpy.zeros(block.shape, dtype = bool)
+        if self.low is not None:
+            fired |= block < self.low
+        if self.high is not None:
+            fired |= block > self.high
+        if self.slew is not None:
+            if self.last is None:
+                self.last = numpy.int64(block[0])
+            fired[0] |= numpy.abs(block[0] - self.last) > self.slew
+            fired[1:] |= numpy.abs(
+                numpy.diff(numpy.int64(block), axis = 0)) > self.slew
+            self.last = numpy.int64(block[-1])
+        events = None
+        if self.event is not None:
+            # The event mask is a word of bits, so read it unsigned.
+            words = numpy.ascontiguousarray(block[:, self.event, 0]).view(
+                numpy.uint32)
+            events = (words & self.mask) != 0
+            fired[:, self.event, 0] |= events
+
+        samples = numpy.flatnonzero(fired.any(axis = (1, 2)))
+        if len(samples) == 0:
+            return None
+        sample = samples[0]
+        index, axis = numpy.argwhere(fired[sample])[0]
+        if index == self.event and events[sample]:
+            reason = 'event 0x%x' % (words[sample] & self.mask)
+        else:
+            reason = 'id %d %s at %d' % (
+                self.ids[index], 'XY'[axis], block[sample, index, axis])
+        return sample, reason
+
+
+class snapshot:
+    '''A captured snapshot: time is the trigger time in seconds, reason the
+    description returned by trigger.check(), and blocks a list of (timestamp,
+    duration, id0, data) as returned by subscription.read_extended(), where the
+    first offset samples of the first block are omitted from its data.'''
+
+    def __init__(self, time, reason, blocks, offset, samples):
+        self.time = time
+        self.reason = reason
+        self.blocks = blocks
+        self.offset = offset
+        self.samples = samples
+
+
+class snapshot_capture:
+    '''c = snapshot_capture(trigger, block_size, pre, post, on_snapshot)
+
+    Feeds blocks of an extended subscription, passed to c.add() as read,
+    through a trigger.  Each time the trigger fires a snapshot of the pre
+    samples before the trigger and post samples from it is gathered and passed
+    to on_snapshot() once complete.  The trigger is rearmed once the snapshot
+    is complete and a whole block has passed without the trigger firing, so a
+    condition which persists gives a single snapshot.  The history is rebuilt
+    from the blocks following a snapshot, so the pre-trigger window of the
+    next snapshot can be short if the trigger fires again soon after.'''
+
+    def __init__(self, trigger, block_size, pre, post, on_snapshot):
+        self.trigger = trigger
+        self.block_size = block_size
+        self.pre = pre
+        self.post = post
+        self.on_snapshot = on_snapshot
+        self.history = collections.deque()
+        self.history_samples = 0
+        self.current = None         # Snapshot being gathered
+        self.remaining = 0          # Post trigger samples still wanted
+        self.armed = True
+
+    def add(self, timestamp, duration, id0, data):
+        fired = self.trigger.check(data)
+        if self.current is not None:
+            self.__gather((timestamp, duration, id0, data))
+        else:
+            self.history.append((timestamp, duration, id0, data))
+            self.history_samples += len(data)
+            # Keep just enough blocks to cover the pre-trigger window.
+            while self.history_samples - len(self.history[0][3]) >= \
+                    self.pre + len(data):
+                self.history_samples -= len(self.history.popleft()[3])
+            if fired is None:
+                self.armed = True
+            elif self.armed:
+                self.__fire(*fired)
+
+    def __fire(self, sample, reason):
+        blocks = list(self.history)
+        timestamp, duration, id0, data = blocks[-1]
+        time = 1e-6 * (timestamp + sample * duration / self.block_size)
+        # Drop history before the start of the pre-trigger window.
+        skip = max(self.history_samples - len(data) + sample - self.pre, 0)
+        while skip >= len(blocks[0][3]):
+            skip -= len(blocks.pop(0)[3])
+        # Cut the trigger block at the end of the post-trigger window, and the
+        # first block at the start of the pre-trigger window.
+        end = sample + self.post
+        start = skip if len(blocks) == 1 else 0
+        blocks[-1] = (timestamp, duration, id0, data[start:end])
+        if len(blocks) > 1:
+            first = blocks[0]
+            blocks[0] = first[:3] + (first[3][skip:],)
+
+        self.history.clear()
+        self.history_samples = 0
+        self.current = snapshot(time, reason, blocks, skip,
+            sum(len(block[3]) for block in blocks))
+        self.remaining = end - len(data)
+        if self.remaining <= 0:
+            self.__complete()
+
+    def __gather(self, block):
+        timestamp, duration, id0, data = block
+        data = data[:self.remaining]
+        self.current.blocks.append((timestamp, duration, id0, data))
+        self.current.samples += len(data)
+        self.remaining -= len(data)
+        if self.remaining <= 0:
+            self.__complete()
+
+    def __complete(self):
+        self.on_snapshot(self.current)
+        self.current = None
+        self.armed = False
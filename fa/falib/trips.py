@@ -0,0 +1,69 @@
+# Detection of beam trips in decimated data
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# A beam trip shows up in every BPM at once: either the beam is lost and the
+# positions collapse or go wild, or the orbit steps as a corrector or RF trips.
+# Either way most BPMs move a long way within a single decimated sample, which
+# ordinary orbit motion, however large at one BPM, doesn't do.  A decimated
+# sample is flagged for a BPM when its min or max is further than a step from
+# the mean of the previous sample, and a trip is reported when enough BPMs are
+# flagged in the same sample.
+
+import numpy
+
+
+__all__ = ['trip_detector']
+
+
+class trip_detector:
+    '''t = trip_detector(step, fraction=0.5, holdoff=10)
+
+    Detects trips in a stream of decimated data, passed block by block to
+    t.update().  A trip is detected when at least the given fraction of ids
+    move by more than step (in archive units, nm) within one sample.  Further
+    trips within holdoff seconds of a trip are ignored.'''
+
+    def __init__(self, step, fraction = 0.5, holdoff = 10):
+        self.step = step
+        self.fraction = fraction
+        self.holdoff = holdoff
+        self.last_mean = None
+        self.last_trip = -numpy.inf
+
+    def update(self, times, data):
+        '''Takes a block of decimated data with sample times in seconds, with
+        data indexed by sample, id, field (mean, min, max) and X/Y, returns the
+        times of any trips detected.'''
+        if len(data) == 0:
+            return []
+        data = numpy.float64(data)
+        means = data[:, :, 0]
+        if self.last_mean is None:
+            self.last_mean = means[0]
+        previous = numpy.concatenate((self.last_mean[None], means[:-1]))
+        self.last_mean = means[-1]
+
+        moved = numpy.maximum(
+            data[:, :, 2] - previous, previous - data[:, :, 1]) > self.step
+        count = numpy.sum(numpy.any(moved, axis = 2), axis = 1)
+        trips = []
+        for n in numpy.nonzero(count >= self.fraction * data.shape[1])[0]:
+            if times[n] - self.last_trip >= self.holdoff:
+                trips.append(times[n])
+                self.last_trip = times[n]
+        return trips
@@ -0,0 +1,212 @@
+# Long term beam variance statistics
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# The decimated archive records the mean and standard deviation of each
+# decimation window, which between them carry the full beam variance at a tiny
+# fraction of the full data rate.  Variances can't simply be averaged: the
+# variance over a long period is the mean of the window variances plus the
+# variance of the window means.  Here statistics are carried as (count, mean,
+# M2) triples, where M2 is the sum of squared deviations from the mean, and are
+# combined with the parallel variance formula of Chan et al, which is exact and
+# numerically stable however many blocks are combined.
+#
+# The accumulated statistics are kept per FA id in rolling hourly, daily and
+# weekly tables, each a fixed size ring of rows in a memory mapped .npy file, so
+# that an aggregator can be stopped and restarted and the tables read by other
+# tools at any time.
+
+import os
+import numpy
+from numpy.lib.format import open_memmap
+
+
+__all__ = ['combine_moments', 'sample_moments', 'decimated_moments',
+    'variance_table', 'variance_aggregator']
+
+
+def combine_moments(n_a, mean_a, m2_a, n_b, mean_b, m2_b):
+    '''Combines the statistics of two sets of samples, each given as count,
+    mean and sum of squared deviations from the mean, returns the combined
+    (count, mean, M2).'''
+    n = n_a + n_b
+    if n == 0:
+        return n, mean_a, m2_a
+    delta = mean_b - mean_a
+    mean = mean_a + delta * (n_b / n)
+    m2 = m2_a + m2_b + delta**2 * (n_a * n_b / n)
+    return n, mean, m2
+
+
+def sample_moments(data):
+    '''Returns (count, mean, M2) along the first axis of a block of samples.'''
+    data = numpy.float64(data)
+    mean = data.mean(axis = 0)
+    m2 = numpy.sum((data - mean)**2, axis = 0)
+    return len(data), mean, m2
+
+
+def decimated_moments(means, stds, decimation):
+    '''Returns (count, mean, M2) of the full rate data summarised by a block
+    of decimated samples, given the mean and standard deviation fields of each
+    sample and the number of full rate samples in each.  Each standard
+    deviation is taken to be the population standard deviation of its
+    decimation window.'''
+    means = numpy.float64(means)
+    stds = numpy.float64(stds)
+    mean = means.mean(axis = 0)
+    m2 = decimation * (
+        numpy.sum(stds**2, axis = 0) + numpy.sum((means - mean)**2, axis = 0))
+    return decimation * len(means), mean, m2
+
+
+class variance_table:
+    '''t = variance_table(filename, ids, seconds, rows, offset=0)
+
+    Rolling table of statistics for the given list of FA ids, one row for each
+    period of the given number of seconds, with the most recent rows periods
+    kept.  Periods start at multiples of seconds after offset seconds into the
+    Unix epoch.  The table is stored in the given file, which is created if
+    necessary.  Statistics for a period are added with t.add(), and t.read()
+    returns the table contents in time order.'''
+
+    def __init__(self, filename, ids, seconds, rows, offset = 0):
+        self.seconds = seconds
+        self.offset = offset
+        self.rows = rows
+        count = len(ids)
+        dtype = numpy.dtype([
+            ('period', '<i8'), ('count', '<f8'),
+            ('mean', '<f8', (count, 2)), ('m2', '<f8', (count, 2))])
+        if os.path.exists(filename):
+            self.table = open_memmap(filename, mode = 'r+')
+            if self.table.dtype != dtype or len(self.table) != rows:
+                raise ValueError('Table %s has the wrong layout' % filename)
+        else:
+            self.table = open_memmap(
+                filename, mode = 'w+', dtype = dtype, shape = (rows,))
+            self.table['period'] = -1
+
+    def periods(self, times):
+        '''Returns the period number of each of the given times in seconds.'''
+        return numpy.int64(numpy.floor((times - self.offset) / self.seconds))
+
+    def add(self, period, n, mean, m2):
+        '''Adds statistics for the given FA ids to the given period, replacing
+        any older period held in the same row.'''
+        row = self.table[period % self.rows]
+        if row['period'] != period:
+            if row['period'] > period:
+                # Too old to be held in the table.
+                return
+            row['period'] = period
+            row['count'] = 0
+            row['mean'] = 0
+            row['m2'] = 0
+        row['count'], row['mean'], row['m2'] = combine_moments(
+            row['count'], row['mean'], row['m2'], n, mean, m2)
+
+    def read(self):
+        '''Returns (starts, counts, means, stds) for all periods held in the
+        table in time order, where starts are the period start times in
+        seconds.  The standard deviation is the RMS deviation of the beam from
+        its mean position over each period.'''
+        valid = self.table[self.table['period'] >= 0]
+        valid = valid[numpy.argsort(valid['period'])]
+        starts = valid['period'] * self.seconds + self.offset
+        counts = valid['count']
+        stds = numpy.sqrt(valid['m2'] / numpy.maximum(counts, 1)[:, None, None])
+        return starts, counts, valid['mean'], stds
+
+    def flush(self):
+        self.table.flush()
+
+
+class variance_aggregator:
+    '''a = variance_aggregator(directory, ids=None)
+
+    Maintains rolling hourly, daily and weekly per id statistics for the given
+    list of FA ids in the given directory, created if necessary.  If ids is not
+    given the directory must already hold tables.  Blocks of
+    data are passed to a.add() with their timestamps, and the tables are
+    available as a.tables, a dictionary indexed by period name.'''
+
+    # For each table the name, period in seconds, number of periods kept and
+    # offset of the first period.  Weeks start on Monday 5 January 1970.
+    Tables = [
+        ('hourly',  3600,       24 * 7 * 4,  0),
+        ('daily',   86400,      366 * 2,     0),
+        ('weekly',  7 * 86400,  52 * 10,     4 * 86400)]
+
+    def __init__(self, directory, ids = None):
+        if not os.path.isdir(directory):
+            os.makedirs(directory)
+        id_file = os.path.join(directory, 'ids.npy')
+        if ids is None:
+            # Use the ids of an existing set of tables.
+            ids = numpy.load(id_file)
+        ids = numpy.array(sorted(ids), dtype = numpy.int32)
+        if os.path.exists(id_file):
+            if not numpy.array_equal(numpy.load(id_file), ids):
+                raise ValueError(
+                    'Directory %s holds statistics for different ids' %
+                    directory)
+        else:
+            numpy.save(id_file, ids)
+        self.ids = ids
+
+        self.tables = {}
+        for name, seconds, rows, offset in self.Tables:
+            self.tables[name] = variance_table(
+                os.path.join(directory, name + '.npy'),
+                ids, seconds, rows, offset)
+
+    def add(self, start, interval, data, decimation = 1):
+        '''Adds a block of data to all tables, where start is the timestamp of
+        the first sample and interval is the time between samples, both in
+        microseconds as for the block headers returned by read_extended().
+        Full rate data is indexed by sample, id and channel, and decimated data
+        is indexed by sample, id, field and channel, where the fields are the
+        mean and standard deviation and each sample summarises decimation full
+        rate samples.'''
+        samples = len(data)
+        if samples == 0:
+            return
+        times = 1e-6 * (start + interval * numpy.arange(samples))
+        periods = [
+            (table, table.periods(times)) for table in self.tables.values()]
+        # Split the block at every period boundary of any table, normally there
+        # are none.  As days and weeks start on the hour these are the hourly
+        # boundaries, and each part lies in a single period of every table, so
+        # its moments are computed once and added to all of them.
+        boundary = numpy.zeros(samples - 1, dtype = bool)
+        for _, table_periods in periods:
+            boundary |= numpy.diff(table_periods) != 0
+        starts = numpy.nonzero(boundary)[0] + 1
+        for first, last in zip(numpy.r_[0, starts], numpy.r_[starts, samples]):
+            part = data[first:last]
+            if decimation == 1:
+                moments = sample_moments(part)
+            else:
+                moments = decimated_moments(
+                    part[:, :, 0], part[:, :, 1], decimation)
+            for table, table_periods in periods:
+                table.add(table_periods[first], *moments)
+
+    def flush(self):
+        for table in self.tables.values():
+            table.flush()
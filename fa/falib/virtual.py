@@ -0,0 +1,161 @@
+# Virtual FA ids derived from real ids
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Signals such as the position and angle of the beam at an insertion device
+# source point are fixed linear combinations of the positions at neighbouring
+# BPMs.  Each such signal is defined as a virtual FA id with X and Y outputs,
+# and a request for any mix of real and virtual ids is turned into a request
+# for the real ids together with all the ids the virtual ids are computed
+# from.  Each block read is then transformed with a single matrix product of
+# the (samples, 2 * sources) source data with a (2 * sources, 2 * virtual ids)
+# matrix of coefficients, and the results are merged with the real ids into
+# the layout the caller asked for.  Results are rounded back to integer
+# nanometres, so virtual ids look exactly like real ids to the tools reading
+# them.
+#
+# Virtual ids are defined by a VIRTUAL list in the location file, each entry
+# of the form
+#
+#   (fa_id, name, x_terms, y_terms)
+#
+# where each list of terms gives (source_id, axis, coefficient) with axis 'X'
+# or 'Y'.  The virtual id must not be a real FA id.
+
+import numpy
+
+
+__all__ = ['virtual_ids']
+
+
+class virtual_request:
+    '''The transform for one request for a list of real and virtual ids.'''
+
+    def __init__(self, virtual, mask):
+        self.ids = sorted(set(mask))
+        wanted = [id for id in self.ids if id in virtual.index]
+        real = [id for id in self.ids if id not in virtual.index]
+        columns = numpy.array([
+            2 * virtual.index[id] + axis for id in wanted for axis in (0, 1)])
+        matrix = virtual.matrix[:, columns]
+        # Only the sources contributing to the wanted ids need be read.
+        used = numpy.nonzero(matrix.reshape(-1, 2, len(columns)).any(
+            axis = (1, 2)))[0]
+        sources = [virtual.sources[n] for n in used]
+        rows = numpy.array([2 * n + axis for n in used for axis in (0, 1)],
+            dtype = int)
+        self.matrix = matrix[rows]
+
+        self.fetch = sorted(set(real) | set(sources))
+        self.real_index = [self.fetch.index(id) for id in real]
+        self.real_pos = [self.ids.index(id) for id in real]
+        self.source_index = [self.fetch.index(id) for id in sources]
+        self.virtual_pos = [self.ids.index(id) for id in wanted]
+
+    def apply(self, block):
+        '''Transforms a block of data for the fetched ids, indexed by sample,
+        id, optionally field, and X/Y, into the requested ids.'''
+        shape = block.shape
+        result = numpy.empty(
+            (shape[0], len(self.ids)) + shape[2:], dtype = block.dtype)
+        result[:, self.real_pos] = block[:, self.real_index]
+        # Bring the id and X/Y axes together at the end for the product.
+        sources = numpy.moveaxis(block[:, self.source_index], 1, -2)
+        middle = sources.shape[:-2]
+        sources = sources.reshape((-1, 2 * len(self.source_index)))
+        virtual = numpy.dot(sources, self.matrix).reshape(
+            middle + (len(self.virtual_pos), 2))
+        result[:, self.virtual_pos] = numpy.moveaxis(
+            numpy.rint(virtual), -2, 1)
+        return result
+
+
+class virtual_reader:
+    '''Wraps a subscription or archive reader for the fetched ids of a
+    virtual_request, delivering data for the requested ids.  All other
+    attributes are those of the underlying reader.'''
+
+    def __init__(self, reader, request):
+        self.reader = reader
+        self.request = request
+        self.count = len(request.ids)
+        if getattr(reader, 'shape', None):
+            self.shape = (self.count,) + reader.shape[1:]
+
+    def __getattr__(self, name):
+        return getattr(self.reader, name)
+
+    def read(self, samples):
+        return self.request.apply(self.reader.read(samples))
+
+    def read_extended(self):
+        block = self.reader.read_extended()
+        if block is None:
+            return None
+        timestamp, duration, id0, data = block
+        return timestamp, duration, id0, self.request.apply(data)
+
+    def __iter__(self):
+        while True:
+            block = self.read_extended()
+            if block is None:
+                break
+            yield block
+
+
+class virtual_ids:
+    '''v = virtual_ids(definitions)
+
+    Virtual FA ids defined by a list of (fa_id, name, x_terms, y_terms) as
+    described above.  A subscription or archive reader is wrapped with
+    v.reader(open_reader, mask), where open_reader opens a reader for a list
+    of real ids.'''
+
+    def __init__(self, definitions):
+        self.ids = [fa_id for fa_id, _, _, _ in definitions]
+        self.names = [name for _, name, _, _ in definitions]
+        self.index = dict((fa_id, n) for n, fa_id in enumerate(self.ids))
+        self.sources = sorted(set(
+            source
+            for _, _, x_terms, y_terms in definitions
+            for source, _, _ in x_terms + y_terms))
+        source_index = dict((id, n) for n, id in enumerate(self.sources))
+        for source in self.sources:
+            if source in self.index:
+                raise ValueError(
+                    'Virtual id %d defined from virtual id' % source)
+
+        self.matrix = numpy.zeros((2 * len(self.sources), 2 * len(self.ids)))
+        for n, (fa_id, _, x_terms, y_terms) in enumerate(definitions):
+            for output, terms in enumerate([x_terms, y_terms]):
+                for source, axis, coefficient in terms:
+                    row = 2 * source_index[source] + 'XY'.index(axis.upper())
+                    self.matrix[row, 2 * n + output] += coefficient
+
+    def selects(self, mask):
+        '''Returns True if any of the ids in mask are virtual.'''
+        return any(id in self.index for id in mask)
+
+    def reader(self, open_reader, mask, decimated = False, fields = 1):
+        '''Returns a reader for the ids in mask, reading the real ids needed
+        with open_reader(ids).  Only the mean of decimated data is a linear
+        function of the data, so decimated data must be the mean alone.'''
+        if decimated and fields != 1:
+            raise ValueError(
+                'Only the mean of virtual ids can be read from decimated data')
+        request = virtual_request(self, mask)
+        return virtual_reader(open_reader(request.fetch), request)
@@ -0,0 +1,130 @@
+# Streaming zoom FFT of a narrow frequency band
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# The frequency resolution of an FFT is the reciprocal of the length of data
+# transformed, so resolving lines 0.01 Hz apart needs 100 s of data whatever
+# is done.  A full FFT of 100 s of 10 kHz data computes a million bins to look
+# at a few hundred of them, and needs all the raw data kept in memory.
+#
+# Instead the band of interest is mixed down to zero frequency with a complex
+# oscillator, low pass filtered to the band width and decimated, and only the
+# decimated complex samples are kept.  As each block arrives the filter state
+# is carried forward, so the history can be much longer than the block of
+# data available at any one time, and the FFT is only the size of the number
+# of decimated points kept.
+
+import numpy
+from scipy import signal
+
+
+__all__ = ['zoom_fft']
+
+
+class zoom_fft:
+    '''z = zoom_fft(f_s, low, high, points, shape=(2,))
+
+    Computes the spectrum of the band low to high Hz in a stream of data
+    sampled at f_s from the most recent points decimated samples.  Each sample
+    has the given shape.  Blocks of data indexed by sample are passed to
+    z.update(), and z.spectrum() returns the spectrum of the band in units per
+    sqrt(Hz), scaled as for a full FFT of the raw data.  The corresponding
+    frequencies are in z.frequencies and the resolution in Hz is
+    z.resolution.'''
+
+    # Ratio of decimated sample rate to band width, and of low pass filter
+    # cutoff to band width.  With an eighth order filter this places aliases
+    # from outside the band at least 80dB down.
+    OVERSAMPLE = 2.5
+    CUTOFF = 0.6
+    ORDER = 8
+
+    def __init__(self, f_s, low, high, points, shape = (2,)):
+        assert 0 <= low < high <= f_s / 2, 'Invalid frequency band'
+        self.f_s = f_s
+        self.low = low
+        self.high = high
+        self.points = points
+        self.shape = tuple(shape)
+
+        span = high - low
+        self.decimation = max(1, int(f_s / (self.OVERSAMPLE * span)))
+        self.f_out = f_s / self.decimation
+        self.resolution = self.f_out / points
+        self.sos = signal.butter(
+            self.ORDER, min(self.CUTOFF * span, 0.45 * f_s), fs = f_s,
+            output = 'sos')
+        self.step = -2 * numpy.pi * (low + high) / 2 / f_s
+
+        # Bins of the shifted FFT which fall within the band.
+        offsets = numpy.fft.fftshift(numpy.fft.fftfreq(points, 1 / self.f_out))
+        self.bins = numpy.abs(offsets) <= span / 2
+        self.frequencies = (low + high) / 2 + offsets[self.bins]
+
+        # Hann window normalised to unit mean, as for the viewer's FFT.
+        self.window = 1 + numpy.cos(
+            numpy.linspace(-numpy.pi, numpy.pi, points))
+        self.reset()
+
+    def reset(self):
+        channels = int(numpy.prod(self.shape))
+        self.zi = numpy.zeros(
+            (len(self.sos), 2, channels), dtype = numpy.complex128)
+        self.phase = 0.
+        # Offset into the next block of the next sample to keep.
+        self.offset = 0
+        self.history = numpy.zeros((self.points, channels), numpy.complex128)
+        self.count = 0
+
+    def update(self, block):
+        '''Updates the decimated history with a block of data.'''
+        length = len(block)
+        if length == 0:
+            return
+        block = block.reshape(length, -1)
+        oscillator = numpy.exp(1j * (
+            self.phase + self.step * numpy.arange(length)))
+        self.phase = (self.phase + length * self.step) % (2 * numpy.pi)
+        mixed, self.zi = signal.sosfilt(
+            self.sos, oscillator[:, None] * block, axis = 0, zi = self.zi)
+
+        kept = mixed[self.offset::self.decimation][-self.points:]
+        self.offset = (self.offset - length) % self.decimation
+        if len(kept):
+            self.history = numpy.roll(self.history, -len(kept), axis = 0)
+            self.history[-len(kept):] = kept
+            self.count = min(self.count + len(kept), self.points)
+
+    def spectrum(self, windowed = True):
+        '''Returns the amplitude spectrum of the band indexed by frequency,
+        computed from the decimated samples seen so far.'''
+        # Until the history is full transform just the valid samples, padded
+        # out to the full length.
+        count = max(self.count, 1)
+        data = self.history[self.points - count:]
+        if windowed:
+            if count == self.points:
+                window = self.window
+            else:
+                window = 1 + numpy.cos(
+                    numpy.linspace(-numpy.pi, numpy.pi, count))
+            data = data * window[:, None]
+        fft = numpy.fft.fftshift(
+            numpy.fft.fft(data, n = self.points, axis = 0), axes = 0)
+        result = numpy.abs(fft[self.bins]) * \
+            numpy.sqrt(2.0 / (self.f_out * count))
+        return result.reshape((len(self.frequencies),) + self.shape)
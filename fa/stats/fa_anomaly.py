@@ -0,0 +1,166 @@
+# Watches live data for misbehaving BPMs
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Runs a falib.anomaly_detector on a single live full rate subscription for all
+# the requested ids and prints each anomaly as it starts and clears.  The -X
+# option instead runs the detector on synthetic data to measure how much of one
+# core it needs to keep up with full rate data.
+
+import sys
+import time
+import optparse
+import datetime
+import numpy
+
+from fa import falib
+
+
+parser = optparse.OptionParser(usage = '''\
+fa-anomaly [options] [pv-list]
+
+Monitors live full rate data for the given ids and reports each BPM whose noise,
+noise relative to its usual noise, peak to peak range, or run of identical
+readings goes beyond the given limits.  The pv-list is a comma separated list of
+FA ids or ranges of ids, and defaults to all archived ids.''')
+parser.add_option(
+    '-N', dest = 'noise', default = None, type = 'float',
+    help = 'Largest standard deviation over a window, in micrometres')
+parser.add_option(
+    '-R', dest = 'ratio', default = 3, type = 'float',
+    help = 'Largest standard deviation over a window as a multiple of the '
+        'usual standard deviation, default 3')
+parser.add_option(
+    '-M', dest = 'span', default = None, type = 'float',
+    help = 'Largest peak to peak range over a window, in micrometres')
+parser.add_option(
+    '-K', dest = 'stuck', default = 1000, type = 'int',
+    help = 'Longest run of identical samples, default 1000')
+parser.add_option(
+    '-w', dest = 'window', default = 1, type = 'float',
+    help = 'Window for statistics in seconds, default 1')
+parser.add_option(
+    '-X', dest = 'benchmark', default = None, type = 'float',
+    help = 'Measure the processor time needed for this many seconds of '
+        'synthetic data instead of monitoring live data')
+parser.add_option(
+    '-S', dest = 'server', default = falib.falib.DEFAULT_SERVER,
+    help = 'Specify archive server to read from')
+parser.add_option(
+    '-p', dest = 'port', default = falib.falib.DEFAULT_PORT, type = 'int',
+    help = 'Specify port to connect to on server')
+parser.add_option(
+    '-q', dest = 'quiet', default = False, action = 'store_true',
+    help = 'Only report anomalies as they start')
+options, args = parser.parse_args()
+
+if len(args) > 1:
+    parser.error('Unexpected arguments')
+try:
+    fa_ids = falib.parse_mask(args[0]) if args else None
+except ValueError as error:
+    parser.error(str(error))
+
+limits = falib.anomaly_limits(
+    noise = None if options.noise is None else 1e3 * options.noise,
+    ratio = options.ratio or None,
+    span = None if options.span is None else 1e3 * options.span,
+    stuck = options.stuck or None)
+
+
+# Benchmark data rate and shape, chosen to match a full storage ring.
+BENCHMARK_F_S = 10072
+BENCHMARK_IDS = 256
+BENCHMARK_BLOCK = 1024
+
+
+def benchmark(seconds):
+    '''Runs the detector on random data and reports the processor time used as
+    a percentage of the time the data covers.'''
+    ids = fa_ids or list(range(BENCHMARK_IDS))
+    detector = falib.anomaly_detector(ids, limits,
+        window = int(options.window * BENCHMARK_F_S))
+    blocks = int(seconds * BENCHMARK_F_S / BENCHMARK_BLOCK)
+    data = numpy.random.normal(0, 1000, (BENCHMARK_BLOCK, len(ids), 2))
+    data = numpy.int32(data)
+
+    used = 0
+    for n in range(blocks):
+        # Shift the data so that successive blocks are not identical.
+        data += numpy.int32(n)
+        start = time.process_time()
+        detector.update(data)
+        used += time.process_time() - start
+    covered = blocks * BENCHMARK_BLOCK / BENCHMARK_F_S
+    print('%d ids, %.1f s of data at %d Hz: %.2f s processor, '
+        '%.1f%% of one core' % (
+            len(ids), covered, BENCHMARK_F_S, used, 100 * used / covered))
+
+
+def report(timestamp, f_s, start_sample, event):
+    sample, fa_id, axis, kind, active, value = event
+    if not active and options.quiet:
+        return
+    when = timestamp + (sample - start_sample) / f_s
+    if kind == 'ratio':
+        value = '%.1f' % value
+    elif kind == 'stuck':
+        value = '%d samples' % value
+    else:
+        value = '%.3f um' % (1e-3 * value)
+    print('%s id %d %s %s %s %s' % (
+        datetime.datetime.fromtimestamp(when).isoformat(),
+        fa_id, 'XY'[axis], kind, 'start' if active else 'clear', value))
+    sys.stdout.flush()
+
+
+def main():
+    if options.benchmark:
+        benchmark(options.benchmark)
+        return
+
+    try:
+        server = falib.Server(server = options.server, port = options.port)
+        ids = fa_ids
+        if ids is None:
+            ids = server.get_archived_ids()
+        f_s = server.sample_frequency
+        ids = sorted(ids)
+        detector = falib.anomaly_detector(ids, limits,
+            window = int(options.window * f_s))
+        sub = server.subscription(ids, extended = True)
+    except Exception as error:
+        print('Unable to start: %s' % error, file = sys.stderr)
+        sys.exit(1)
+
+    status = 0
+    try:
+        while True:
+            timestamp, _, _, data = sub.read_extended()
+            # Events are reported against the end of the block, so take the
+            # sample count before the update to place them in time.
+            start_sample = detector.samples
+            for event in detector.update(data):
+                report(1e-6 * timestamp, f_s, start_sample, event)
+    except KeyboardInterrupt:
+        pass
+    except Exception as error:
+        print('Stopped: %s' % error, file = sys.stderr)
+        status = 1
+    finally:
+        sub.close()
+    sys.exit(status)
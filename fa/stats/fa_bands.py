@@ -0,0 +1,235 @@
+# Publishes band limited RMS motion of all BPMs
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Headless service computing falib.band_rms over successive windows of a single
+# live full rate subscription.  Each update is sent as one line of JSON to every
+# client connected to a local TCP port, and optionally added to a
+# falib.band_table on disk.
+
+import sys
+import json
+import time
+import optparse
+import numpy
+
+import cothread
+from cothread import cosocket
+
+from fa import falib
+
+
+# Tables are flushed to disk at least this often, in seconds.
+FLUSH_INTERVAL = 60
+
+
+parser = optparse.OptionParser(usage = '''\
+fa-bands [options] [pv-list]
+
+Computes the RMS motion of each FA id in a number of frequency bands over
+successive windows of live full rate data, and publishes the results on a
+local TCP port and optionally in a rolling table on disk.  The pv-list is a
+comma separated list of FA ids or ranges of ids, and defaults to all archived
+ids.''')
+parser.add_option(
+    '-B', dest = 'bands', default = '1-100,100-1000',
+    help = 'Comma separated list of frequency bands low-high in Hz, '
+        'default 1-100,100-1000')
+parser.add_option(
+    '-w', dest = 'window', default = 1, type = 'float',
+    help = 'Interval between updates in seconds, default 1')
+parser.add_option(
+    '-n', dest = 'segments', default = 1, type = 'int',
+    help = 'Number of segments averaged in each window, default 1')
+parser.add_option(
+    '-P', dest = 'publish', default = 8890, type = 'int',
+    help = 'Local port to publish results on, default 8890, 0 for none')
+parser.add_option(
+    '-d', dest = 'directory', default = None,
+    help = 'Directory for rolling table of results')
+parser.add_option(
+    '-k', dest = 'keep', default = 24, type = 'float',
+    help = 'Hours of results kept in the table, default 24')
+parser.add_option(
+    '-S', dest = 'server', default = falib.falib.DEFAULT_SERVER,
+    help = 'Specify archive server to read from')
+parser.add_option(
+    '-p', dest = 'port', default = falib.falib.DEFAULT_PORT, type = 'int',
+    help = 'Specify port to connect to on server')
+parser.add_option(
+    '-q', dest = 'quiet', default = False, action = 'store_true',
+    help = 'Suppress display of progress')
+options, args = parser.parse_args()
+
+if len(args) > 1:
+    parser.error('Unexpected arguments')
+try:
+    fa_ids = falib.parse_mask(args[0]) if args else None
+    bands = []
+    for band in options.bands.split(','):
+        low, high = map(float, band.split('-'))
+        if not 0 <= low < high:
+            raise ValueError('Invalid band %s' % band)
+        bands.append((low, high))
+    if not options.publish and not options.directory:
+        raise ValueError('Must publish on a port or to a directory')
+except ValueError as error:
+    parser.error(str(error))
+
+
+class publisher:
+    '''Sends lines of text to every client connected to a local port.  Each
+    client is sent its lines from its own queue, and a client which can't keep
+    up is disconnected rather than holding up the updates.'''
+
+    # Longest queue of lines we allow a client before disconnecting it.
+    MAX_QUEUE = 10
+
+    def __init__(self, port):
+        self.sock = cosocket.socket()
+        self.sock.setsockopt(cosocket.SOL_SOCKET, cosocket.SO_REUSEADDR, 1)
+        self.sock.bind(('localhost', port))
+        self.sock.listen(5)
+        self.clients = []
+        cothread.Spawn(self.__accept)
+
+    def __accept(self):
+        while True:
+            client, _ = self.sock.accept()
+            client.settimeout(1)
+            queue = cothread.EventQueue()
+            self.clients.append(queue)
+            cothread.Spawn(self.__send, client, queue)
+
+    def __send(self, client, queue):
+        # Lines are sent until the client fails or is dropped by publish(),
+        # which queues None.
+        try:
+            while True:
+                data = queue.Wait()
+                if data is None:
+                    break
+                client.sendall(data)
+        except OSError:
+            pass
+        if queue in self.clients:
+            self.clients.remove(queue)
+        client.close()
+
+    def publish(self, line):
+        data = (line + '\n').encode()
+        for queue in list(self.clients):
+            if len(queue) < self.MAX_QUEUE:
+                queue.Signal(data)
+            else:
+                self.clients.remove(queue)
+                queue.Signal(None)
+
+
+def carry(blocks, samples):
+    '''Drops the first samples from a list of (timestamp, duration, data)
+    blocks, returning the blocks left.  The timestamp and duration of a block
+    cut part way through are adjusted to the samples kept.'''
+    while samples:
+        timestamp, duration, data = blocks[0]
+        if samples < len(data):
+            interval = duration / len(data)
+            blocks[0] = (
+                timestamp + samples * interval,
+                duration - samples * interval, data[samples:])
+            break
+        del blocks[0]
+        samples -= len(data)
+    return blocks
+
+
+def process(sub, ids, rms, publish, table):
+    '''Gathers windows of samples from the subscription and publishes the band
+    RMS of each window until interrupted.  Each window is timed by the
+    timestamp of its first sample.'''
+    blocks = []
+    count = 0
+    updates = 0
+    flushed = time.time()
+    while True:
+        timestamp, duration, _, data = sub.read_extended()
+        blocks.append((timestamp, duration, data))
+        count += len(data)
+        if count < rms.samples:
+            continue
+
+        start = 1e-6 * blocks[0][0]
+        data = numpy.concatenate([block for _, _, block in blocks])
+        result = rms.compute(data[:rms.samples])
+        if publish:
+            publish.publish(json.dumps(dict(
+                time = start, bands = bands, ids = ids,
+                rms = numpy.round(1e-3 * result, 4).tolist())))
+        if table:
+            table.add(start, result)
+
+        # Carry the remaining samples over to the next window.
+        blocks = carry(blocks, rms.samples)
+        count -= rms.samples
+        updates += 1
+
+        now = time.time()
+        if table and now - flushed >= FLUSH_INTERVAL:
+            table.flush()
+            flushed = now
+        if not options.quiet:
+            sys.stderr.write('%d updates, %d clients\r' % (
+                updates, len(publish.clients) if publish else 0))
+
+
+def main():
+    try:
+        server = falib.Server(server = options.server, port = options.port)
+        ids = fa_ids
+        if ids is None:
+            ids = server.get_archived_ids()
+        ids = sorted(ids)
+        f_s = server.sample_frequency
+        rms = falib.band_rms(f_s, int(options.window * f_s), bands,
+            segments = options.segments)
+        table = None
+        if options.directory:
+            table = falib.band_table(options.directory, ids, bands,
+                int(3600 * options.keep / options.window))
+        publish = None
+        if options.publish:
+            publish = publisher(options.publish)
+        sub = server.subscription(ids, extended = True)
+    except Exception as error:
+        print('Unable to start: %s' % error, file = sys.stderr)
+        sys.exit(1)
+
+    status = 0
+    try:
+        process(sub, ids, rms, publish, table)
+    except KeyboardInterrupt:
+        pass
+    except Exception as error:
+        print('\nStopped: %s' % error, file = sys.stderr)
+        status = 1
+    finally:
+        sub.close()
+        if table:
+            table.flush()
+    if not options.quiet:
+        sys.stderr.write('\n')
+    sys.exit(status)
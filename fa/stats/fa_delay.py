@@ -0,0 +1,156 @@
+# Reports relative delays of motion between BPMs
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Feeds a single live full rate subscription for all the ids of the selected
+# pairs into a falib.delay_estimator, and periodically prints the delay and peak
+# correlation of each pair.
+
+import sys
+import optparse
+import datetime
+
+from fa import falib
+
+
+parser = optparse.OptionParser(usage = '''\
+fa-delay [options] [pv-list]
+
+Estimates the delay between the motion of pairs of BPMs from the cross
+correlation of live full rate data, and prints the delay and peak correlation
+of each pair at regular intervals.  By default each id of the pv-list, a comma
+separated list of FA ids or ranges of ids defaulting to all archived ids, is
+paired with the first id as reference.''')
+parser.add_option(
+    '-r', dest = 'reference', default = None, type = 'int',
+    help = 'Reference id paired with every id, default first id')
+parser.add_option(
+    '-c', dest = 'pairs', default = None,
+    help = 'Comma separated list of pairs of ids a:b, instead of a reference')
+parser.add_option(
+    '-n', dest = 'length', default = 1024, type = 'int',
+    help = 'Length of correlated segments in samples, default 1024')
+parser.add_option(
+    '-A', dest = 'averages', default = 100, type = 'int',
+    help = 'Number of segments averaged, default 100, 0 to average all')
+parser.add_option(
+    '-B', dest = 'band', default = None,
+    help = 'Only correlate motion in band low-high in Hz')
+parser.add_option(
+    '-m', dest = 'max_delay', default = 100, type = 'int',
+    help = 'Largest delay searched in samples, default 100')
+parser.add_option(
+    '-t', dest = 'threshold', default = 0, type = 'float',
+    help = 'Only report pairs with a peak correlation at least this large')
+parser.add_option(
+    '-w', dest = 'interval', default = 1, type = 'float',
+    help = 'Interval between reports in seconds, default 1')
+parser.add_option(
+    '-S', dest = 'server', default = falib.falib.DEFAULT_SERVER,
+    help = 'Specify archive server to read from')
+parser.add_option(
+    '-p', dest = 'port', default = falib.falib.DEFAULT_PORT, type = 'int',
+    help = 'Specify port to connect to on server')
+options, args = parser.parse_args()
+
+if len(args) > 1:
+    parser.error('Unexpected arguments')
+try:
+    fa_ids = falib.parse_mask(args[0]) if args else None
+    pairs = None
+    if options.pairs:
+        if options.reference is not None:
+            raise ValueError('Cannot specify both reference and pairs')
+        pairs = []
+        for pair in options.pairs.split(','):
+            a, b = map(int, pair.split(':'))
+            pairs.append((a, b))
+    band = None
+    if options.band:
+        band = tuple(map(float, options.band.split('-')))
+        if not 0 <= band[0] < band[1]:
+            raise ValueError('Invalid band %s' % options.band)
+    if options.length < 4:
+        raise ValueError('Segment length too short')
+except ValueError as error:
+    parser.error(str(error))
+
+
+def select_pairs(server):
+    '''Returns (ids, pairs), the sorted list of ids to subscribe to and the list
+    of pairs of ids to correlate.'''
+    if pairs:
+        ids = sorted(set(id for pair in pairs for id in pair))
+        return ids, pairs
+    else:
+        ids = fa_ids
+        if ids is None:
+            ids = server.get_archived_ids()
+        reference = options.reference
+        if reference is None:
+            reference = ids[0]
+        ids = sorted(set(ids) | set([reference]))
+        return ids, [(reference, id) for id in ids if id != reference]
+
+
+def report(when, estimator, f_s):
+    delay, peak = estimator.delays()
+    stamp = datetime.datetime.fromtimestamp(when).isoformat()
+    for (a, b), delays, peaks in zip(estimator.pairs, delay, peak):
+        for axis in range(2):
+            if abs(peaks[axis]) >= options.threshold:
+                print('%s %d %d %s %+8.2f samples %+9.1f us %+.3f' % (
+                    stamp, a, b, 'XY'[axis], delays[axis],
+                    1e6 * delays[axis] / f_s, peaks[axis]))
+    sys.stdout.flush()
+
+
+def main():
+    try:
+        server = falib.Server(server = options.server, port = options.port)
+        ids, pairs = select_pairs(server)
+        if not pairs:
+            raise ValueError('No pairs to correlate')
+        f_s = server.sample_frequency
+        estimator = falib.delay_estimator(ids, pairs, options.length,
+            averages = options.averages or None,
+            band = band and (band[0] / f_s, band[1] / f_s),
+            max_delay = options.max_delay)
+        sub = server.subscription(ids, extended = True)
+    except Exception as error:
+        print('Unable to start: %s' % error, file = sys.stderr)
+        sys.exit(1)
+
+    status = 0
+    try:
+        interval = int(options.interval * f_s)
+        samples = 0
+        while True:
+            timestamp, _, _, data = sub.read_extended()
+            estimator.update(data)
+            samples += len(data)
+            if samples >= interval and estimator.count:
+                report(1e-6 * timestamp, estimator, f_s)
+                samples -= interval
+    except KeyboardInterrupt:
+        pass
+    except Exception as error:
+        print('Stopped: %s' % error, file = sys.stderr)
+        status = 1
+    finally:
+        sub.close()
+    sys.exit(status)
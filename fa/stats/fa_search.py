@@ -0,0 +1,100 @@
+# Searches the archive for beam excursions
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Command line front end to falib.excursion_search, printing the excursions
+# found ranked by size.
+
+import sys
+import optparse
+import datetime
+
+from fa import falib
+
+
+parser = optparse.OptionParser(usage = '''\
+fa-search [options] -s|-t|-b start~end [pv-list]
+
+Searches a range of the archive, given with -s, -t or -b, for excursions of the
+beam beyond a threshold from its position before the excursion, and prints the
+excursions found ranked by size.  The pv-list is a comma separated list of FA
+ids or ranges of ids, and defaults to all archived ids.''')
+falib.add_time_options(parser)
+parser.add_option(
+    '-T', dest = 'threshold', default = 50, type = 'float',
+    help = 'Excursion threshold in micrometres, default 50')
+parser.add_option(
+    '-B', dest = 'baseline', default = 60, type = 'float',
+    help = 'Seconds before each excursion averaged for the baseline, '
+        'default 60')
+parser.add_option(
+    '-g', dest = 'gap', default = 1, type = 'float',
+    help = 'Excursions closer than this many seconds are merged, default 1')
+parser.add_option(
+    '-n', dest = 'count', default = None, type = 'int',
+    help = 'Only print the largest count excursions')
+parser.add_option(
+    '-S', dest = 'server', default = falib.falib.DEFAULT_SERVER,
+    help = 'Specify archive server to read from')
+parser.add_option(
+    '-p', dest = 'port', default = falib.falib.DEFAULT_PORT, type = 'int',
+    help = 'Specify port to connect to on server')
+parser.add_option(
+    '-q', dest = 'quiet', default = False, action = 'store_true',
+    help = 'Suppress display of progress')
+options, args = parser.parse_args()
+
+if len(args) > 1:
+    parser.error('Unexpected arguments')
+try:
+    fa_ids = falib.parse_mask(args[0]) if args else None
+    if options.start is None:
+        raise ValueError('Must specify a start time range')
+    start, end = falib.parse_time_range(*options.start)
+    if end is None:
+        raise ValueError('Must specify a range of times')
+except ValueError as error:
+    parser.error(str(error))
+
+
+def progress(message):
+    if not options.quiet:
+        print(message, file = sys.stderr)
+
+
+def main():
+    try:
+        server = falib.Server(server = options.server, port = options.port)
+        ids = fa_ids
+        if ids is None:
+            ids = server.get_archived_ids()
+        search = falib.excursion_search(server, ids, start, end,
+            1e3 * options.threshold, baseline = options.baseline,
+            gap = options.gap, progress = progress)
+    except Exception as error:
+        print('Search failed: %s' % error, file = sys.stderr)
+        sys.exit(1)
+
+    for n, e in enumerate(search.excursions[:options.count]):
+        print('%3d %s %10.1f ms %8.1f um  id %d %s%s  ids %s' % (
+            n + 1,
+            datetime.datetime.fromtimestamp(e.start).isoformat(),
+            1e3 * (e.end - e.start), 1e-3 * e.peak, e.fa_id, 'XY'[e.axis],
+            '' if e.source == 'F' else ' (D)',
+            ','.join(map(str, e.ids))))
+    print('%d excursions, read %d bytes, %.3g%% of full rate data' % (
+        len(search.excursions), search.bytes_read, 100 * search.fraction))
@@ -0,0 +1,198 @@
+# Compares beam motion with fast feedback on and off
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Reads two ranges of full rate archive data, one with feedback on and one with
+# it off, both at the same time.  Each range is read in chunks of a few seconds
+# with falib.fetch_parallel, and each chunk is added to a falib.averaged_power
+# as it arrives, so only the running power sum is kept for the whole range.
+# The averaged spectra of all ids are then integrated as in the viewer's
+# integrated mode, and the suppression ratio is the ratio of the motion with
+# feedback off to the motion with feedback on, both per frequency and for the
+# total motion of each BPM.
+
+import sys
+import optparse
+import numpy
+
+import cothread
+
+from fa import falib
+
+
+# Each range is read in chunks of this many seconds.
+CHUNK_LENGTH = 5
+
+
+parser = optparse.OptionParser(usage = '''\
+fa-suppression [options] on-times off-times [pv-list]
+
+Compares the beam motion over two ranges of the archive, the first with fast
+feedback on and the second with it off, and reports the ratio of the RMS motion
+with feedback off to the motion with feedback on for each BPM.  Each range of
+times is written start~end, either as dates and times yyyy-mm-ddThh:mm:ss or
+as times today hh:mm:ss.  The pv-list is a comma separated list of FA ids or
+ranges of ids, and defaults to all archived ids.''')
+parser.add_option(
+    '-n', dest = 'length', default = 1, type = 'float',
+    help = 'Length in seconds of the segments whose spectra are averaged, '
+        'default 1')
+parser.add_option(
+    '-B', dest = 'band', default = None,
+    help = 'Frequency band low-high in Hz for the reported ratios, default '
+        'all frequencies')
+parser.add_option(
+    '-w', dest = 'windowed', default = False, action = 'store_true',
+    help = 'Window each segment before its FFT')
+parser.add_option(
+    '-o', dest = 'output', default = None,
+    help = 'Save spectra, integrated motion and ratios to this .npz file')
+parser.add_option(
+    '-j', dest = 'connections', default = 4, type = 'int',
+    help = 'Number of concurrent connections for each range, default 4')
+parser.add_option(
+    '-S', dest = 'server', default = falib.falib.DEFAULT_SERVER,
+    help = 'Specify archive server to read from')
+parser.add_option(
+    '-p', dest = 'port', default = falib.falib.DEFAULT_PORT, type = 'int',
+    help = 'Specify port to connect to on server')
+parser.add_option(
+    '-q', dest = 'quiet', default = False, action = 'store_true',
+    help = 'Suppress display of progress')
+options, args = parser.parse_args()
+
+if not 2 <= len(args) <= 3:
+    parser.error('Must specify two ranges of times and optional pv-list')
+try:
+    ranges = []
+    for times in args[:2]:
+        start, end = falib.parse_time_range(
+            's' if 'T' in times else 't', times)
+        if end is None:
+            raise ValueError('Must specify a range of times')
+        ranges.append((start, end))
+    fa_ids = falib.parse_mask(args[2]) if len(args) > 2 else None
+    band = None
+    if options.band:
+        band = tuple(map(float, options.band.split('-')))
+        if not 0 <= band[0] < band[1]:
+            raise ValueError('Invalid band %s' % options.band)
+except ValueError as error:
+    parser.error(str(error))
+
+
+def log(message):
+    if not options.quiet:
+        print(message, file = sys.stderr)
+
+
+def fetch(server, ids, start, end, average):
+    '''Reads the full rate data for ids from start to end in chunks, adding
+    each chunk to average.  Each chunk starts from the last sample read, and
+    any samples read again are skipped.'''
+    last = None
+    while True:
+        chunk_end = min(start + CHUNK_LENGTH, end)
+        offset, block_size, blocks = falib.fetch_parallel(
+            server, ids, start, chunk_end, options.connections, source = 'F')
+        for n, (timestamp, duration, _, data) in enumerate(blocks):
+            # Only the first block of a read starts part way through an
+            # archive block.  Times are in microseconds.
+            interval = duration / block_size
+            first = timestamp + interval * (offset if n == 0 else 0)
+            skip = 0
+            if n == 0 and last is not None:
+                skip = max(int(round((last - first) / interval)) + 1, 0)
+            average.update(data[skip:])
+            last = first + interval * (len(data) - 1)
+        if chunk_end >= end or not blocks:
+            break
+        start = 1e-6 * last
+
+
+def analyse(average, f_s, length):
+    '''Returns (frequencies, spectrum, integrated) for a range of data.'''
+    return falib.integrated_motion(average.power(), f_s, length)
+
+
+def band_motion(frequencies, integrated):
+    '''Returns the RMS motion within the selected band from the cumulative
+    motion, indexed by id and X/Y.'''
+    if band is None:
+        return integrated[-1]
+    # The cumulative power up to each frequency, starting from none.
+    power = numpy.concatenate(
+        (numpy.zeros((1,) + integrated.shape[1:]), integrated**2))
+    low, high = numpy.searchsorted(frequencies, band)
+    return numpy.sqrt(numpy.maximum(power[high] - power[low], 0))
+
+
+def report(server, ids, on, off):
+    names = dict(server.get_fa_ids(missing = True))
+    ratio = off / on
+    print('%5s %-20s %9s %9s %7s %9s %9s %7s' % (
+        'id', 'name', 'X off', 'X on', 'X ratio', 'Y off', 'Y on', 'Y ratio'))
+    for n, fa_id in enumerate(ids):
+        print('%5d %-20s %9.3f %9.3f %7.2f %9.3f %9.3f %7.2f' % (
+            fa_id, names.get(fa_id, ''),
+            1e-3 * off[n, 0], 1e-3 * on[n, 0], ratio[n, 0],
+            1e-3 * off[n, 1], 1e-3 * on[n, 1], ratio[n, 1]))
+
+
+def main():
+    try:
+        server = falib.Server(server = options.server, port = options.port)
+        ids = fa_ids
+        if ids is None:
+            ids = server.get_archived_ids()
+        ids = sorted(ids)
+        f_s = server.sample_frequency
+        length = falib.fast_length(int(options.length * f_s))
+
+        log('Reading %d ids' % len(ids))
+        average_on, average_off = [
+            falib.averaged_power(f_s, length, options.windowed)
+            for _ in ranges]
+        tasks = [
+            cothread.Spawn(fetch, server, ids, start, end, average,
+                raise_on_wait = True)
+            for (start, end), average in
+                zip(ranges, [average_on, average_off])]
+        for task in tasks:
+            task.Wait()
+        log('Read %d and %d segments' % (
+            average_on.segments, average_off.segments))
+
+        frequencies, spectrum_on, integrated_on = \
+            analyse(average_on, f_s, length)
+        _, spectrum_off, integrated_off = analyse(average_off, f_s, length)
+    except Exception as error:
+        print('Unable to compute suppression: %s' % error, file = sys.stderr)
+        sys.exit(1)
+
+    with numpy.errstate(invalid = 'ignore', divide = 'ignore'):
+        on = band_motion(frequencies, integrated_on)
+        off = band_motion(frequencies, integrated_off)
+        report(server, ids, on, off)
+        if options.output:
+            numpy.savez(options.output,
+                ids = ids, frequencies = frequencies,
+                spectrum_on = spectrum_on, spectrum_off = spectrum_off,
+                integrated_on = integrated_on, integrated_off = integrated_off,
+                ratio = numpy.sqrt(spectrum_off / spectrum_on),
+                integrated_ratio = integrated_off / integrated_on,
+                rms_on = on, rms_off = off)
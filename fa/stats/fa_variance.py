@@ -0,0 +1,163 @@
+# Accumulates long term beam variance statistics
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Feeds a falib.variance_aggregator either from the decimated archive, using the
+# mean and standard deviation fields, or continuously from the live data
+# stream.  The live decimated stream only carries filtered means, so live data
+# is taken at full rate and reduced to statistics block by block as it arrives.
+
+import os
+import sys
+import time
+import optparse
+import datetime
+
+from fa import falib
+
+
+# Tables are flushed to disk at least this often, in seconds.
+FLUSH_INTERVAL = 60
+
+
+parser = optparse.OptionParser(usage = '''\
+fa-variance [options] [-s|-t|-b start~end] directory [pv-list]
+
+Accumulates hourly, daily and weekly per FA id beam position statistics in the
+given directory.  If a start time range is given the statistics are computed
+from the decimated archive, otherwise live data is processed until interrupted.
+The pv-list is a comma separated list of FA ids or ranges of ids, and defaults
+to the ids already in the directory, or to all archived ids.  With -l the
+selected table is printed instead.''')
+falib.add_time_options(parser)
+parser.add_option(
+    '-f', dest = 'format', default = 'd',
+    help = 'Archive data to read: d (default) for D data or D for DD data')
+parser.add_option(
+    '-l', dest = 'list', default = None,
+    help = 'Print the hourly, daily or weekly table and exit')
+parser.add_option(
+    '-S', dest = 'server', default = falib.falib.DEFAULT_SERVER,
+    help = 'Specify archive server to read from')
+parser.add_option(
+    '-p', dest = 'port', default = falib.falib.DEFAULT_PORT, type = 'int',
+    help = 'Specify port to connect to on server')
+parser.add_option(
+    '-q', dest = 'quiet', default = False, action = 'store_true',
+    help = 'Suppress display of progress')
+options, args = parser.parse_args()
+
+if not 1 <= len(args) <= 2:
+    parser.error('Must specify directory and optional pv-list')
+directory = args[0]
+
+try:
+    fa_ids = falib.parse_mask(args[1]) if len(args) > 1 else None
+    if options.start is None:
+        start, end = None, None
+    else:
+        start, end = falib.parse_time_range(*options.start)
+        if end is None:
+            raise ValueError('Must specify a range of times')
+    source = {'d': 'D', 'D': 'DD'}.get(options.format)
+    if source is None:
+        raise ValueError('Invalid data format %s' % options.format)
+    if options.list not in [None, 'hourly', 'daily', 'weekly']:
+        raise ValueError('Invalid table %s' % options.list)
+except ValueError as error:
+    parser.error(str(error))
+
+
+def print_table(table, ids):
+    starts, counts, means, stds = table.read()
+    for start, count, std in zip(starts, counts, stds):
+        print(datetime.datetime.fromtimestamp(start).isoformat(), '%d' % count)
+        for id, (x, y) in zip(ids, std):
+            print('    %3d  %10.1f %10.1f' % (id, x, y))
+
+
+def accumulate(aggregator, reader, decimation):
+    '''Adds every block from reader to aggregator until the reader is
+    exhausted.'''
+    samples = 0
+    flushed = time.time()
+    offset = reader.offset
+    while True:
+        block = reader.read_extended()
+        if block is None:
+            break
+        timestamp, duration, _, data = block
+        # The block header describes a complete block, but the first block can
+        # start offset samples in.
+        interval = duration / reader.block_size
+        aggregator.add(
+            timestamp + offset * interval, interval, data, decimation)
+        offset = 0
+
+        now = time.time()
+        if now - flushed >= FLUSH_INTERVAL:
+            aggregator.flush()
+            flushed = now
+        samples += len(data)
+        if not options.quiet:
+            sys.stderr.write('%d samples\r' % samples)
+
+
+def main():
+    try:
+        server = falib.Server(server = options.server, port = options.port)
+        ids = fa_ids
+        if ids is None and \
+                not os.path.exists(os.path.join(directory, 'ids.npy')):
+            ids = server.get_archived_ids()
+        aggregator = falib.variance_aggregator(directory, ids)
+    except Exception as error:
+        print('Unable to start: %s' % error, file = sys.stderr)
+        sys.exit(1)
+
+    if options.list:
+        print_table(aggregator.tables[options.list], aggregator.ids)
+        return
+
+    try:
+        if start is None:
+            decimation = 1
+            reader = server.subscription(aggregator.ids, extended = True)
+        else:
+            d, dd = server.get_archive_decimations()
+            decimation = d if source == 'D' else dd
+            # Only the mean and standard deviation fields are needed.
+            reader = server.archive(aggregator.ids, start, end = end,
+                source = source, fields = 1 | 8, all_data = True)
+    except Exception as error:
+        print('Unable to read data: %s' % error, file = sys.stderr)
+        sys.exit(1)
+
+    status = 0
+    try:
+        accumulate(aggregator, reader, decimation)
+    except KeyboardInterrupt:
+        pass
+    except Exception as error:
+        print('\nStopped: %s' % error, file = sys.stderr)
+        status = 1
+    finally:
+        reader.close()
+        aggregator.flush()
+    if not options.quiet:
+        sys.stderr.write('\n')
+    sys.exit(status)
@@ -66,18 +66,36 @@ class monitor:
         self.on_connect = on_connect
         self.on_eof = on_eof
         self.buffer = buffer(buffer_size)
+        self.reference_buffer = buffer(buffer_size)
         self.update_size = read_size
         self.notify_size = read_size
         self.data_ready = 0
         self.running = False
         self.decimated = False
         self.id = 0
+        # Optional second id subscribed alongside id for modes which compare
+        # two channels.
+        self.reference = None
+        # Total number of samples received since the last start, so that
+        # modes which process data incrementally can pick out new samples,
+        # and a count of starts so that they can tell when it restarts.
+        self.samples = 0
+        self.generation = 0
 
     def start(self):
         assert not self.running, 'Strange: we are already running'
+        # The subscription delivers ids in ascending order.
+        ids = [self.id]
+        if self.reference is not None and self.reference != self.id:
+            ids = sorted(ids + [self.reference])
+        self.column = ids.index(self.id)
+        if self.reference is None:
+            self.reference_column = None
+        else:
+            self.reference_column = ids.index(self.reference)
         try:
             self.subscription = self.server.subscription(
-                [self.id], decimated = self.decimated, uncork = self.decimated)
+                ids, decimated = self.decimated, uncork = self.decimated)
         except Exception as message:
             import traceback
             traceback.print_exc()
@@ -85,6 +103,9 @@ class monitor:
         else:
             self.running = True
             self.buffer.reset()
+            self.reference_buffer.reset()
+            self.samples = 0
+            self.generation += 1
             self.task = cothread.Spawn(self.__monitor)
 
     def stop(self):
@@ -102,6 +123,15 @@ class monitor:
         if running:
             self.start()
 
+    def set_reference(self, reference):
+        '''Sets the id read alongside the selected id, or None.'''
+        if reference != self.reference:
+            running = self.running
+            self.stop()
+            self.reference = reference
+            if running:
+                self.start()
+
     def resize(self, notify_size, update_size):
         '''The notify_size is the data size delivered in each update, while
         the update_size determines how frequently an update is delivered.'''
@@ -114,12 +144,16 @@ class monitor:
         self.on_connect()
         while self.running:
             try:
-                block = self.subscription.read(int(self.update_size))[:,0,:]
+                block = self.subscription.read(int(self.update_size))
             except Exception as exception:
                 stop_reason = str(exception)
                 self.running = False
             else:
-                self.buffer.write(block)
+                self.buffer.write(block[:, self.column, :])
+                if self.reference_column is not None:
+                    self.reference_buffer.write(
+                        block[:, self.reference_column, :])
+                self.samples += len(block)
                 self.data_ready += self.update_size
                 self.on_event(self.read())
                 self.data_ready -= self.update_size
@@ -129,3 +163,11 @@ class monitor:
     def read(self):
         '''Can be called at any time to read the most recent buffer.'''
         return 1e-3 * self.buffer.read(self.notify_size)
+
+    def read_reference(self):
+        '''Returns the reference id data matching read(), or None if no
+        reference id is set.'''
+        if self.reference is None:
+            return None
+        else:
+            return 1e-3 * self.reference_buffer.read(self.notify_size)
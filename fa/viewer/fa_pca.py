@@ -0,0 +1,236 @@
+# Live principal components of orbit motion.
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Feeds a single full rate subscription for all the selected ids into a
+# falib.orbit_pca, and shows the recent amplitude of each of the leading modes
+# of orbit motion together with the shape of a selected mode around the ring.
+# The modes are refreshed from the accumulated covariance on a timer, while the
+# amplitudes are computed for every block of data as it arrives.
+
+import optparse
+import numpy
+from PyQt5 import QtGui, QtCore, QtWidgets
+import qwt as Qwt5
+
+import cothread
+from fa import falib
+
+from fa.viewer import tools
+from fa.viewer.modes import X_colour, Y_colour, micrometre
+
+
+DEFAULT_LOCATION = 'SR'
+
+# Samples read from the subscription at a time.
+READ_SIZE = 1000
+
+# Mode amplitudes are shown averaged over this many samples, for this many
+# seconds.
+DISPLAY_DECIMATION = 100
+HISTORY = 10
+
+# Interval between refreshes of the modes and the display in ms.
+UPDATE_INTERVAL = 1000
+
+
+class PCA:
+    def __init__(self, server, ids, modes, time_constant):
+        self.server = server
+        self.ids = ids
+        f_s = server.sample_frequency
+        self.pca = falib.orbit_pca(ids, modes,
+            time_constant * f_s if time_constant else None)
+        self.f_display = f_s / DISPLAY_DECIMATION
+        self.history = numpy.zeros((int(HISTORY * self.f_display), modes))
+        self.mode = 0
+
+        self.ui = QtWidgets.QMainWindow()
+        self.ui.setWindowTitle('FA PCA')
+        central = QtWidgets.QWidget(self.ui)
+        self.ui.setCentralWidget(central)
+        layout = QtWidgets.QVBoxLayout(central)
+
+        controls = QtWidgets.QHBoxLayout()
+        layout.addLayout(controls)
+        controls.addWidget(QtWidgets.QLabel('Mode', central))
+        selector = QtWidgets.QComboBox(central)
+        selector.addItems(['%d' % (n + 1) for n in range(modes)])
+        selector.currentIndexChanged.connect(self.set_mode)
+        controls.addWidget(selector)
+        reset = QtWidgets.QPushButton('Reset', central)
+        reset.clicked.connect(self.reset)
+        controls.addWidget(reset)
+        rescale = QtWidgets.QPushButton('Rescale', central)
+        rescale.clicked.connect(self.rescale)
+        controls.addWidget(rescale)
+        controls.addStretch()
+
+        self.amplitude_plot = tools.makeplot(central)
+        self.amplitude_plot.setAxisTitle(Qwt5.QwtPlot.xBottom, 'Time (s)')
+        self.amplitude_plot.setAxisTitle(
+            Qwt5.QwtPlot.yLeft, 'Mode amplitude (%s)' % micrometre)
+        layout.addWidget(self.amplitude_plot)
+        # One colour for each mode, spread around the colour wheel.
+        self.amplitudes = [
+            tools.makecurve(self.amplitude_plot,
+                QtGui.QColor.fromHsv(int(360 * n / modes), 255, 255))
+            for n in range(modes)]
+
+        self.shape_plot = tools.makeplot(central)
+        self.shape_plot.setAxisTitle(Qwt5.QwtPlot.xBottom, 'BPM index')
+        self.shape_plot.setAxisTitle(Qwt5.QwtPlot.yLeft, 'Mode shape')
+        layout.addWidget(self.shape_plot)
+        self.cx = tools.makecurve(self.shape_plot, X_colour)
+        self.cy = tools.makecurve(self.shape_plot, Y_colour)
+
+        self.status = QtWidgets.QLabel('', self.ui.statusBar())
+        self.ui.statusBar().addWidget(self.status)
+
+        self.timer = QtCore.QTimer()
+        self.timer.setInterval(UPDATE_INTERVAL)
+        self.timer.timeout.connect(self.refresh)
+        self.timer.start()
+
+        cothread.Spawn(self.monitor)
+        self.ui.resize(1000, 700)
+        self.ui.show()
+
+
+    # --------------------------------------------------------------------------
+    # GUI event handlers
+
+    def set_mode(self, ix):
+        self.mode = ix
+        self.redraw()
+
+    def reset(self):
+        self.pca.reset()
+        self.history[:] = 0
+        self.redraw()
+
+    def rescale(self):
+        for plot in [self.amplitude_plot, self.shape_plot]:
+            plot.setAxisAutoScale(Qwt5.QwtPlot.yLeft)
+            plot.setAxisAutoScale(Qwt5.QwtPlot.xBottom)
+            plot.replot()
+
+
+    # --------------------------------------------------------------------------
+    # Data handling
+
+    def monitor(self):
+        try:
+            sub = self.server.subscription(self.ids)
+            while True:
+                block = sub.read(READ_SIZE)
+                self.pca.update(block)
+                # Average the amplitudes down for display.
+                amplitudes = self.pca.amplitudes(block)
+                points = len(amplitudes) // DISPLAY_DECIMATION
+                amplitudes = amplitudes[:points * DISPLAY_DECIMATION].reshape(
+                    (points, DISPLAY_DECIMATION, -1)).mean(axis = 1)
+                self.history = numpy.roll(self.history, -points, axis = 0)
+                self.history[-points:] = 1e-3 * amplitudes
+        except Exception as error:
+            self.timer.stop()
+            self.status.setText('FA server disconnected: %s' % error)
+
+    def refresh(self):
+        if self.pca.count:
+            self.pca.update_modes()
+        self.redraw()
+        total = self.pca.total_variance()
+        if total > 0:
+            self.status.setText(
+                'Mode %d: %.3g %s RMS, %.1f%% of variance; '
+                'modes shown: %.1f%%' % (
+                    self.mode + 1,
+                    1e-3 * numpy.sqrt(self.pca.values[self.mode]), micrometre,
+                    100 * self.pca.values[self.mode] / total,
+                    100 * numpy.sum(self.pca.values) / total))
+
+    def redraw(self):
+        times = (numpy.arange(len(self.history)) - len(self.history)) / \
+            self.f_display
+        for curve, amplitude in zip(self.amplitudes, self.history.T):
+            curve.setData(times, amplitude)
+        index = numpy.arange(len(self.ids))
+        shape = self.pca.vectors[self.mode]
+        self.cx.setData(index, shape[:, 0])
+        self.cy.setData(index, shape[:, 1])
+        self.amplitude_plot.replot()
+        self.shape_plot.replot()
+
+
+parser = optparse.OptionParser(usage = '''\
+fa-pca [options] [location]
+
+Shows the leading modes of orbit motion computed live from the covariance of
+all selected BPMs.  The location can be one of %s, or full path to location
+file if -f specified.  The default location is %s.''' % (
+    ', '.join(falib.config.list_location_files()), DEFAULT_LOCATION))
+parser.add_option(
+    '-i', dest = 'ids', default = None,
+    help = 'Comma separated list of FA ids or ranges of ids, default is all '
+        'archived ids')
+parser.add_option(
+    '-k', dest = 'modes', default = 6, type = 'int',
+    help = 'Number of modes tracked, default 6')
+parser.add_option(
+    '-T', dest = 'time_constant', default = 60, type = 'float',
+    help = 'Time constant in seconds over which the covariance is averaged, '
+        'default 60, 0 to average all data')
+parser.add_option(
+    '-f', dest = 'full_path', default = False, action = 'store_true',
+    help = 'Location is full path to location file')
+parser.add_option(
+    '-S', dest = 'server', default = None,
+    help = 'Override server address in location file')
+parser.add_option(
+    '-P', dest = 'port', default = None,
+    help = 'Override server port in location file')
+options, arglist = parser.parse_args()
+if len(arglist) > 1:
+    parser.error('Unexpected arguments')
+if arglist:
+    location = arglist[0]
+else:
+    location = DEFAULT_LOCATION
+try:
+    fa_ids = falib.parse_mask(options.ids) if options.ids else None
+    if options.modes < 1:
+        raise ValueError('Must track at least one mode')
+except ValueError as error:
+    parser.error(str(error))
+
+falib.load_location_file(
+    globals(), location, options.full_path,
+    server = options.server, port = options.port)
+
+server = falib.Server(server = FA_SERVER, port = FA_PORT, virtual = VIRTUAL)
+
+
+def main():
+    qapp = cothread.iqt()
+    key_filter = tools.KeyFilter()
+    qapp.installEventFilter(key_filter)
+
+    ids = fa_ids or server.get_archived_ids()
+    pca = PCA(server, ids, options.modes, options.time_constant)
+
+    cothread.WaitForQuit()
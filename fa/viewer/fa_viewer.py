@@ -30,40 +30,25 @@ import os
 import optparse
 from PyQt5 import QtGui, QtCore, QtWidgets, uic
 import qwt as Qwt5
-from guiqwt.plot import PlotManager
-from guiqwt.curve import CurvePlot, CurveItem
-from guiqwt.events import PanHandler, AutoZoomHandler, ZoomRectHandler
-from guiqwt.styles import GridParam
-from guiqwt.tools import RectZoomTool
 
 import cothread
 from fa import falib
 
 from fa.viewer import modes
 from fa.viewer import buffer
+from fa.viewer import tools
 
 from fa.viewer.modes import X_colour, Y_colour
 
 
-class CustomZoomTool(RectZoomTool):
-    """RectZoomTool modified to use right-click to pan."""
-
-    def setup_filter(self, baseplot):
-        filter = baseplot.filter
-        start_state = filter.new_state()
-        handler = ZoomRectHandler(filter, QtCore.Qt.LeftButton, start_state=start_state)
-        handler.set_shape(*self.get_shape())
-        PanHandler(filter, QtCore.Qt.RightButton, start_state=start_state)
-        AutoZoomHandler(filter, QtCore.Qt.MidButton, start_state=start_state)
-        return start_state
-
-
 #   FA Sniffer Viewer
 
 # This is the implementation of the viewer as a Qt display application.
 
 Display_modes = [
-    modes.mode_raw, modes.mode_fft, modes.mode_fft_logf, modes.mode_integrated]
+    modes.mode_raw, modes.mode_fft, modes.mode_fft_logf, modes.mode_integrated,
+    modes.mode_lines, modes.mode_zoom_fft, modes.mode_allan,
+    modes.mode_coherence]
 
 Timebase_list = [
     ('100ms', 1000),    ('250ms', 2500),    ('0.5s',  5000),
@@ -81,6 +66,9 @@ INITIAL_MODE = 0
 # Default location used if no location specified on command line.
 DEFAULT_LOCATION = 'SR'
 
+# Frequencies in Hz shown in Lines mode, unless overridden in the location file.
+LINE_FREQUENCIES = [50, 100, 150, 200, 250, 300]
+
 
 class SpyMouse(QtCore.QObject):
     MouseMove = QtCore.pyqtSignal(QtCore.QPoint)
@@ -97,10 +85,6 @@ class SpyMouse(QtCore.QObject):
 
 
 class Viewer:
-    Plot_tooltip = \
-        'Click and drag to zoom in, ' \
-        'middle click to zoom out, right click and drag to pan.'
-
     '''application class'''
     def __init__(self, ui, server):
         self.ui = ui
@@ -110,6 +94,7 @@ class Viewer:
         self.monitor = buffer.monitor(
             server, self.on_data_update, self.on_connect, self.on_eof,
             500000, 10000)
+        self.line_frequencies = LINE_FREQUENCIES
 
         # Prepare the selections in the controls
         ui.timebase.addItems([l[0] for l in Timebase_list])
@@ -164,13 +149,7 @@ class Viewer:
         self.ui.show()
 
     def makecurve(self, colour, dotted=False):
-        c = CurveItem()
-        pen = QtGui.QPen(colour)
-        if dotted:
-            pen.setStyle(QtCore.Qt.DotLine)
-        c.setPen(pen)
-        c.attach(self.plot)
-        return c
+        return tools.makecurve(self.plot, colour, dotted)
 
     def makeplot(self):
         '''set up plotting'''
@@ -178,23 +157,13 @@ class Viewer:
         self.ui.axes.setLayout(QtWidgets.QGridLayout(self.ui.axes))
 
         # Draw a plot in the frame using guiqwt.
-        plot = CurvePlot(self.ui.axes, gridparam=GridParam())
+        plot = tools.makeplot(self.ui.axes)
         self.ui.axes.layout().addWidget(plot)
-        pm = PlotManager(self.ui.axes)
-        pm.add_plot(plot)
-        plot.set_manager(pm, id(plot))
-        pm.add_tool(CustomZoomTool)
-        pm.get_tool(CustomZoomTool).activate()
 
         self.plot = plot
         self.cx = self.makecurve(X_colour)
         self.cy = self.makecurve(Y_colour)
 
-        # set background to black
-        plot.setCanvasBackground(QtCore.Qt.black)
-
-        plot.setStatusTip(self.Plot_tooltip)
-
         # Monitor mouse movements over the plot area so we can show the position
         # in coordinates.
         SpyMouse(plot.canvas()).MouseMove.connect(self.mouse_move)
@@ -263,11 +232,25 @@ class Viewer:
             timebase / factor, min(timebase, SCROLL_THRESHOLD) / factor)
 
     def set_mode(self, ix):
+        band = self.visible_band()
         self.mode.set_enable(False)
         self.mode = self.mode_list[ix]
         self.mode.set_enable(True)
+        if band:
+            self.mode.select_band(*band)
         self.reset_mode()
 
+    def visible_band(self):
+        '''Returns the frequency range currently zoomed into, or None if the
+        current mode isn't showing a linear frequency axis or isn't zoomed.'''
+        if self.mode.xunits == 'Hz' and \
+                self.mode.xscale is Qwt5.QwtLinearScaleEngine:
+            scale = self.plot.axisScaleDiv(Qwt5.QwtPlot.xBottom)
+            band = (scale.lowerBound(), scale.upperBound())
+            if band != (self.mode.xmin, self.mode.xmax):
+                return band
+        return None
+
     def toggle_running(self, running):
         if running:
             self.monitor.start()
@@ -341,18 +324,6 @@ class Viewer:
         self.on_data_update(self.monitor.read())
 
 
-class KeyFilter(QtCore.QObject):
-    # Implements ctrl-Q or the standard binding for fast exit.
-    def eventFilter(self, watched, event):
-        if event.type() == QtCore.QEvent.KeyPress:
-            key = QtGui.QKeyEvent(event)
-            # \x11 is CTRL-Q; I can't find any other way to force a match.
-            if key.text() == '\x11' or key.matches(QtGui.QKeySequence.Quit):
-                cothread.Quit()
-                return True
-        return False
-
-
 parser = optparse.OptionParser(usage = '''\
 fa-viewer [-f] [location]
 
@@ -382,7 +353,7 @@ falib.load_location_file(
     globals(), location, options.full_path,
     server = options.server, port = options.port)
 
-server = falib.Server(server = FA_SERVER, port = FA_PORT)
+server = falib.Server(server = FA_SERVER, port = FA_PORT, virtual = VIRTUAL)
 F_S = server.sample_frequency
 decimation_factor = server.decimation
 FA_ID_list = server.get_fa_ids(missing = True)
@@ -391,7 +362,7 @@ BPM_list = falib.compute_bpm_groups(FA_ID_list, GROUPS, PATTERNS)
 
 def main():
     qapp = cothread.iqt()
-    key_filter = KeyFilter()
+    key_filter = tools.KeyFilter()
     qapp.installEventFilter(key_filter)
 
     # create and show form
@@ -1,8 +1,10 @@
 # Mode Specific Functionality
 
-# Four display modes are supported: raw data, FFT of data with linear and with
-# logarithmic frequency axis, and integrated displacement (derived from the
-# FFT).  These modes and their user support functionality are implemented by the
+# Eight display modes are supported: raw data, FFT of data with linear and with
+# logarithmic frequency axis, integrated displacement (derived from the FFT),
+# the amplitudes of a fixed set of spectral lines, a high resolution zoom FFT of
+# a narrow band, Allan deviation, and coherence against a second channel.
+# These modes and their user support functionality are implemented by the
 # classes below, one for each display mode.
 
 # Copyright (c) 2011 Michael Abbott, Diamond Light Source Ltd.
@@ -35,6 +37,8 @@ import numpy
 from PyQt5 import QtGui, QtWidgets, QtCore
 import qwt as Qwt5
 
+from fa import falib
+
 
 # Actually, these really belong in fa-viewer.py, but the practicalities of doing
 # this are not worth the trouble.
@@ -66,9 +70,13 @@ class mode_common:
         self.show_x = True
         self.show_y = True
         self.__tray.setVisible(False)
+        self.seen = None
 
     def set_enable(self, enabled):
         self.__tray.setVisible(enabled)
+        # Data received while another mode is selected is never seen, so
+        # modes using unseen() start again rather than have a gap in the data.
+        self.seen = None
 
     def addWidget(self, widget):
         self.__tray_layout.addWidget(widget)
@@ -77,6 +85,11 @@ class mode_common:
         self.show_x = show_x
         self.show_y = show_y
 
+    def select_band(self, low, high):
+        '''Called with the visible frequency range when switching to this mode
+        from a linear frequency display.'''
+        pass
+
     def plot(self, value):
         v = self.compute(value)
         self.parent.cx.setData(self.xaxis, v[:, 0])
@@ -85,6 +98,27 @@ class mode_common:
     def compute(self, value):
         return value
 
+    def reset_data(self):
+        '''Starts accumulating data again from the next update.  Modes which
+        accumulate data across updates with unseen() extend this to reset their
+        own state.'''
+        self.seen = self.parent.monitor.samples
+        self.generation = self.parent.monitor.generation
+
+    def unseen(self, value):
+        '''Returns the samples at the end of value not returned by an earlier
+        call.  If samples may have been missed, because the mode has just been
+        selected or because the monitor restarted its count when the
+        subscription changed, reset_data() is called and nothing is
+        returned.'''
+        monitor = self.parent.monitor
+        samples = monitor.samples
+        if self.seen is None or monitor.generation != self.generation:
+            self.reset_data()
+        new = min(samples - self.seen, len(value))
+        self.seen = samples
+        return value[len(value) - new:]
+
     def get_minmax(self, value):
         value = self.compute(value)
         ix = (self.show_x, self.show_y)
@@ -250,37 +284,6 @@ class mode_raw(mode_common):
         self.set_visible()
 
 
-def scaled_abs_fft(value, sample_frequency, windowed=False, axis=0):
-    '''Returns the fft of value (along axis 0) scaled so that values are in
-    units per sqrt(Hz).  The magnitude of the first half of the spectrum is
-    returned.'''
-    if windowed:
-        # The Hann window is good enough.  In some cases the Hamming window
-        # looks a bit better, but then I'd need a choice of windows.  Not really
-        # the point here, so just go for the simplest...
-        window = 1 + numpy.cos(
-            numpy.linspace(-numpy.pi, numpy.pi, value.shape[axis]))
-        value = value * window[:, None]
-    fft = numpy.fft.fft(value, axis=axis)
-
-    # This trickery below is simply implementing fft[:N//2] where the slicing is
-    # along the specified axis rather than axis 0.  It does seem a bit
-    # complicated...
-    N = value.shape[axis]
-    slice = [numpy.s_[:] for s in fft.shape]
-    slice[axis] = numpy.s_[:N//2]
-    fft = fft[tuple(slice)]
-
-    # Finally scale the result into units per sqrt(Hz)
-    return numpy.abs(fft) * numpy.sqrt(2.0 / (sample_frequency * N))
-
-def fft_timebase(sample_count, sample_frequency, scale=1.0):
-    '''Returns a waveform suitable for an FFT timebase with the given number of
-    points.'''
-    return scale * sample_frequency * \
-        numpy.arange(sample_count // 2) / sample_count
-
-
 class mode_fft(mode_common):
     mode_name = 'FFT'
     xname = 'Frequency'
@@ -323,7 +326,7 @@ class mode_fft(mode_common):
 
     def set_decimation(self, decimation):
         self.decimation = decimation
-        self.xaxis = fft_timebase(
+        self.xaxis = falib.fft_timebase(
             self.sample_count // self.decimation, self.sample_frequency)
 
     def set_squared_state(self, show_squared):
@@ -342,7 +345,7 @@ class mode_fft(mode_common):
     def compute(self, value):
         windowed = self.windowed.isChecked()
         if self.decimation == 1:
-            result = scaled_abs_fft(
+            result = falib.scaled_abs_fft(
                 value, self.sample_frequency, windowed = windowed)
         else:
             # Compute a decimated fft by segmenting the waveform (by reshaping),
@@ -352,7 +355,7 @@ class mode_fft(mode_common):
             points = len(value) // self.decimation
             value = value[:points * self.decimation].reshape(
                 (self.decimation, points, 2))
-            fft = scaled_abs_fft(
+            fft = falib.scaled_abs_fft(
                 value, self.sample_frequency, windowed = windowed, axis=1)
             result = numpy.sqrt(numpy.mean(fft**2, axis=0))
         if self.show_squared:
@@ -361,31 +364,6 @@ class mode_fft(mode_common):
             return result
 
 
-def compute_gaps(l, N):
-    '''This computes a series of logarithmically spaced indexes into an array
-    of length l.  N is a hint for the number of indexes, but the result may
-    be somewhat shorter.'''
-    gaps = numpy.int_(numpy.logspace(0, numpy.log10(l), N))
-    counts = numpy.diff(gaps)
-    return counts[counts > 0]
-
-def condense(value, counts):
-    '''The given waveform is condensed in logarithmic intervals so that the same
-    number of points are generated in each decade.  The accumulation and number
-    of accumulated points are returned as separate waveforms.'''
-
-    # The result is the same shape as the value in all axes except the first.
-    shape = list(value.shape)
-    shape[0] = len(counts)
-    sums = numpy.empty(shape)
-
-    left = 0
-    for i, step in enumerate(counts):
-        sums[i] = numpy.sum(value[left:left + step], axis=0)
-        left += step
-    return sums
-
-
 FFT_LOGF_POINTS = 5000
 
 class mode_fft_logf(mode_common):
@@ -402,17 +380,18 @@ class mode_fft_logf(mode_common):
     def set_timebase(self, sample_count, sample_frequency):
         self.sample_frequency = sample_frequency
         self.xmax = sample_frequency / 2
-        self.counts = compute_gaps(sample_count // 2 - 1, FFT_LOGF_POINTS)
+        self.counts = falib.compute_gaps(
+            sample_count // 2 - 1, FFT_LOGF_POINTS)
         self.xaxis = sample_frequency * numpy.cumsum(self.counts) / sample_count
         self.xmin = self.xaxis[0]
         self.reset = True
 
     def compute(self, value):
         windowed = self.windowed.isChecked()
-        fft = scaled_abs_fft(
+        fft = falib.scaled_abs_fft(
             value, self.sample_frequency, windowed = windowed)[1:]
         fft_logf = numpy.sqrt(
-            condense(fft**2, self.counts) / self.counts[:,None])
+            falib.condense(fft**2, self.counts) / self.counts[:,None])
         if self.scalef:
             fft_logf *= self.xaxis[:, None]
 
@@ -489,15 +468,17 @@ class mode_integrated(mode_common):
     def set_timebase(self, sample_count, sample_frequency):
         self.sample_frequency = sample_frequency
         self.xmax = sample_frequency / 2
-        self.counts = compute_gaps(sample_count // 2 - 1, FFT_LOGF_POINTS)[1:]
+        self.counts = falib.compute_gaps(
+            sample_count // 2 - 1, FFT_LOGF_POINTS)[1:]
         self.xaxis = sample_frequency * (
             numpy.cumsum(self.counts) + 1) / sample_count
         self.xmin = self.xaxis[0]
 
     def compute(self, value):
         N = len(value)
-        fft2 = condense(
-            scaled_abs_fft(value, self.sample_frequency)[2:]**2, self.counts)
+        fft2 = falib.condense(
+            falib.scaled_abs_fft(value, self.sample_frequency)[2:]**2,
+            self.counts)
         if self.reversed:
             cumsum = numpy.cumsum(fft2[::-1], axis=0)[::-1]
         else:
@@ -549,3 +530,355 @@ class mode_integrated(mode_common):
         mode_common.show_xy(self, show_x, show_y)
         self.cxb.setVisible(show_x)
         self.cyb.setVisible(show_y)
+
+
+class mode_lines(mode_common):
+    '''Shows the amplitudes of the spectral lines listed in LINE_FREQUENCIES,
+    tracked continuously by a falib.line_bank fed with each new block of data.
+    Each line is drawn as a vertical stick at its frequency.'''
+
+    mode_name = 'Lines'
+    xname = 'Frequency'
+    yname = 'Amplitude'
+    xshortname = 'f'
+    xunits = 'Hz'
+    yunits = micrometre
+    xscale = Qwt5.QwtLinearScaleEngine
+    yscale = Qwt5.QwtLogScaleEngine
+    xticks = 5
+    xmin = 0
+    ymin = 1e-4
+    ymax = 1
+
+    # Sticks are drawn up from this level
+    floor = 1e-6
+
+    Time_constants = [1, 10, 100]
+
+    def __init__(self, parent):
+        mode_common.__init__(self, parent)
+        self.frequencies = parent.line_frequencies
+
+        self.addWidget(QtWidgets.QLabel('Time constant', parent.ui))
+        selector = QtWidgets.QComboBox(parent.ui)
+        selector.addItems(['%ds' % t for t in self.Time_constants])
+        self.addWidget(selector)
+        selector.currentIndexChanged.connect(self.set_time_constant)
+
+        self.time_constant = self.Time_constants[0]
+        self.sample_frequency = None
+
+    def set_time_constant(self, ix):
+        self.time_constant = self.Time_constants[ix]
+        self.reset_data()
+
+    def set_timebase(self, sample_count, sample_frequency):
+        if sample_frequency != self.sample_frequency:
+            self.sample_frequency = sample_frequency
+            self.reset_data()
+
+    def reset_data(self):
+        lines = [f for f in self.frequencies if f < self.sample_frequency / 2]
+        self.bank = falib.line_bank(
+            lines, self.sample_frequency, time_constant = self.time_constant)
+        if lines:
+            self.xaxis = numpy.repeat(lines, 3)
+            self.xmax = 1.1 * max(lines)
+        else:
+            self.xaxis = numpy.zeros(1)
+            self.xmax = self.sample_frequency / 2
+        mode_common.reset_data(self)
+
+    def compute(self, value):
+        new = self.unseen(value)
+        if len(new):
+            self.bank.update(new)
+
+        sticks = numpy.empty((len(self.xaxis), 2))
+        sticks[:] = self.floor
+        sticks[1::3] = self.bank.amplitude
+        return sticks
+
+
+class mode_zoom_fft(mode_common):
+    '''Shows a high resolution spectrum of a narrow band computed by a
+    falib.zoom_fft fed with each new block of data, so the spectrum can cover
+    far more data than the selected timebase.  The band is taken from the
+    visible frequency range when switching from another linear frequency
+    display, or when the Zoom button is pressed.'''
+
+    mode_name = 'Zoom FFT'
+    xname = 'Frequency'
+    yname = 'Amplitude'
+    xshortname = 'f'
+    xunits = 'Hz'
+    yunits = '%s/%sHz' % (micrometre, char_sqrt)
+    xscale = Qwt5.QwtLinearScaleEngine
+    yscale = Qwt5.QwtLogScaleEngine
+    xticks = 5
+    ymin = 1e-4
+    ymax = 1
+
+    Points = [1024, 4096, 16384]
+
+    # Narrowest band we will zoom into, in Hz.
+    min_span = 0.1
+
+    def __init__(self, parent):
+        mode_common.__init__(self, parent)
+
+        self.windowed = QtWidgets.QCheckBox('Windowed', parent.ui)
+        self.windowed.setChecked(True)
+        self.addWidget(self.windowed)
+
+        self.addWidget(QtWidgets.QLabel('Points', parent.ui))
+        selector = QtWidgets.QComboBox(parent.ui)
+        selector.addItems(['%d' % n for n in self.Points])
+        self.addWidget(selector)
+        selector.currentIndexChanged.connect(self.set_points)
+
+        button = QtWidgets.QPushButton('Zoom', parent.ui)
+        self.addWidget(button)
+        button.clicked.connect(self.zoom_to_view)
+
+        self.resolution = QtWidgets.QLabel('', parent.ui)
+        self.addWidget(self.resolution)
+
+        self.points = self.Points[1]
+        selector.setCurrentIndex(1)
+        self.band = (49, 51)
+        self.sample_frequency = None
+
+    def set_points(self, ix):
+        self.points = self.Points[ix]
+        self.reset_data()
+
+    def select_band(self, low, high):
+        self.band = (low, high)
+        if self.sample_frequency:
+            self.reset_data()
+
+    def zoom_to_view(self):
+        band = self.parent.visible_band()
+        if band:
+            self.select_band(*band)
+            self.parent.reset_mode()
+
+    def set_timebase(self, sample_count, sample_frequency):
+        if sample_frequency != self.sample_frequency:
+            self.sample_frequency = sample_frequency
+            self.reset_data()
+
+    def reset_data(self):
+        nyquist = self.sample_frequency / 2
+        low, high = self.band
+        low = min(max(low, 0), nyquist - self.min_span)
+        high = min(max(high, low + self.min_span), nyquist)
+        self.zoom = falib.zoom_fft(
+            self.sample_frequency, low, high, self.points)
+        self.xaxis = self.zoom.frequencies
+        self.xmin = low
+        self.xmax = high
+        self.resolution.setText('Resolution %.3g Hz' % self.zoom.resolution)
+        mode_common.reset_data(self)
+
+    def compute(self, value):
+        new = self.unseen(value)
+        if len(new):
+            self.zoom.update(new)
+        return self.zoom.spectrum(self.windowed.isChecked())
+
+
+class mode_allan(mode_common):
+    '''Shows the overlapping Allan deviation of all data received since the
+    mode was selected or reset, accumulated by a falib.allan_pyramid fed with
+    each new block of data.'''
+
+    mode_name = 'Allan deviation'
+    xname = 'Averaging time'
+    yname = 'Allan deviation'
+    xshortname = 'tau'
+    xunits = 's'
+    yshortname = 'sigma'
+    yunits = micrometre
+    xscale = Qwt5.QwtLogScaleEngine
+    yscale = Qwt5.QwtLogScaleEngine
+    xticks = 10
+    ymin = 1e-4
+    ymax = 10
+
+    def __init__(self, parent):
+        mode_common.__init__(self, parent)
+
+        button = QtWidgets.QPushButton('Reset', parent.ui)
+        self.addWidget(button)
+        button.clicked.connect(self.reset_data)
+
+        self.sample_frequency = None
+
+    def set_timebase(self, sample_count, sample_frequency):
+        if sample_frequency != self.sample_frequency:
+            self.sample_frequency = sample_frequency
+            self.reset_data()
+
+    def reset_data(self):
+        self.allan = falib.allan_pyramid(self.sample_frequency)
+        self.xmin = self.allan.taus[0]
+        self.xmax = self.allan.taus[-1]
+        mode_common.reset_data(self)
+
+    def compute(self, value):
+        new = self.unseen(value)
+        if len(new):
+            self.allan.update(new)
+
+        # Only show averaging times we have enough data for.
+        valid = self.allan.counts > 0
+        if valid.any():
+            self.xaxis = self.allan.taus[valid]
+            return self.allan.deviation()[valid]
+        else:
+            self.xaxis = self.allan.taus[:1]
+            return numpy.full((1, 2), self.ymin)
+
+
+class mode_coherence(mode_common):
+    '''Shows the coherence or relative phase of the selected BPM against a
+    reference id, X against X and Y against Y, or of X against Y of the
+    selected BPM if no reference is given.  Spectra are accumulated by a
+    falib.cross_spectrum fed with each new block of data.'''
+
+    mode_name = 'Coherence'
+    xname = 'Frequency'
+    xshortname = 'f'
+    xunits = 'Hz'
+    xscale = Qwt5.QwtLinearScaleEngine
+    yscale = Qwt5.QwtLinearScaleEngine
+    xticks = 5
+    xmin = 0
+
+    Points = [256, 1024, 4096]
+    Averages = [10, 100, None]
+
+    def __init__(self, parent):
+        mode_common.__init__(self, parent)
+
+        self.addWidget(QtWidgets.QLabel('Reference', parent.ui))
+        self.reference = QtWidgets.QLineEdit(parent.ui)
+        self.reference.setValidator(
+            QtGui.QIntValidator(0, parent.monitor.server.fa_id_count - 1,
+                parent.ui))
+        self.reference.setMaximumWidth(60)
+        self.reference.setToolTip('Reference FA id, blank for X against Y')
+        self.reference.editingFinished.connect(self.set_reference)
+        self.addWidget(self.reference)
+
+        self.show_phase = QtWidgets.QCheckBox('Phase', parent.ui)
+        self.show_phase.stateChanged.connect(self.set_show_phase)
+        self.addWidget(self.show_phase)
+
+        self.addWidget(QtWidgets.QLabel('Points', parent.ui))
+        selector = QtWidgets.QComboBox(parent.ui)
+        selector.addItems(['%d' % n for n in self.Points])
+        self.addWidget(selector)
+        selector.currentIndexChanged.connect(self.set_points)
+
+        self.addWidget(QtWidgets.QLabel('Averages', parent.ui))
+        averages = QtWidgets.QComboBox(parent.ui)
+        averages.addItems([
+            '%d' % n if n else 'All' for n in self.Averages])
+        self.addWidget(averages)
+        averages.currentIndexChanged.connect(self.set_averages)
+
+        button = QtWidgets.QPushButton('Reset', parent.ui)
+        self.addWidget(button)
+        button.clicked.connect(self.reset_data)
+
+        self.points = self.Points[1]
+        selector.setCurrentIndex(1)
+        self.averages = self.Averages[1]
+        averages.setCurrentIndex(1)
+        self.reference_id = None
+        self.sample_frequency = None
+        self.set_phase_state(False)
+
+    def set_enable(self, enabled):
+        mode_common.set_enable(self, enabled)
+        # Only subscribe to the reference while this mode is shown.
+        if enabled:
+            self.parent.monitor.set_reference(self.reference_id)
+        else:
+            self.parent.monitor.set_reference(None)
+
+    def set_reference(self):
+        text = self.reference.text()
+        reference_id = int(text) if text else None
+        if reference_id != self.reference_id:
+            self.reference_id = reference_id
+            self.parent.monitor.set_reference(reference_id)
+            if self.sample_frequency:
+                self.reset_data()
+
+    def set_phase_state(self, show_phase):
+        self.phase = show_phase
+        if show_phase:
+            self.yname = 'Phase'
+            self.yshortname = 'phi'
+            self.yunits = 'deg'
+            self.ymin = -180
+            self.ymax = 180
+        else:
+            self.yname = 'Coherence'
+            self.yshortname = 'C'
+            self.yunits = 'ratio'
+            self.ymin = 0
+            self.ymax = 1.05
+
+    def set_show_phase(self, show_phase):
+        self.set_phase_state(show_phase != 0)
+        self.parent.reset_mode()
+
+    def set_points(self, ix):
+        self.points = self.Points[ix]
+        if self.sample_frequency:
+            self.reset_data()
+
+    def set_averages(self, ix):
+        self.averages = self.Averages[ix]
+        if self.sample_frequency:
+            self.reset_data()
+
+    def set_timebase(self, sample_count, sample_frequency):
+        self.xmax = sample_frequency / 2
+        if sample_frequency != self.sample_frequency:
+            self.sample_frequency = sample_frequency
+            self.reset_data()
+
+    def reset_data(self):
+        shape = (2,) if self.reference_id is not None else (1,)
+        self.spectrum = falib.cross_spectrum(
+            self.sample_frequency, self.points, shape, self.averages)
+        self.xaxis = self.spectrum.frequencies
+        mode_common.reset_data(self)
+
+    def rescale(self, value):
+        # Coherence and phase have fixed ranges.
+        pass
+
+    def compute(self, value):
+        new = self.unseen(value)
+        reference = self.parent.monitor.read_reference()
+        if len(new):
+            if self.reference_id is None:
+                self.spectrum.update(new[:, :1], new[:, 1:])
+            elif reference is not None:
+                self.spectrum.update(new, reference[-len(new):])
+
+        if self.phase:
+            result = self.spectrum.phase()
+        else:
+            result = self.spectrum.coherence()
+        if self.reference_id is None:
+            # Both curves show X against Y.
+            result = numpy.repeat(result, 2, axis = 1)
+        return result
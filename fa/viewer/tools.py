@@ -0,0 +1,79 @@
+# Plot and interaction helpers shared by the GUI tools
+
+# Copyright (c) 2011 Michael Abbott, Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+from PyQt5 import QtGui, QtCore
+from guiqwt.events import PanHandler, AutoZoomHandler, ZoomRectHandler
+from guiqwt.tools import RectZoomTool
+from guiqwt.plot import PlotManager
+from guiqwt.curve import CurvePlot, CurveItem
+from guiqwt.styles import GridParam
+
+import cothread
+
+
+Plot_tooltip = \
+    'Click and drag to zoom in, ' \
+    'middle click to zoom out, right click and drag to pan.'
+
+
+class CustomZoomTool(RectZoomTool):
+    """RectZoomTool modified to use right-click to pan."""
+
+    def setup_filter(self, baseplot):
+        filter = baseplot.filter
+        start_state = filter.new_state()
+        handler = ZoomRectHandler(filter, QtCore.Qt.LeftButton, start_state=start_state)
+        handler.set_shape(*self.get_shape())
+        PanHandler(filter, QtCore.Qt.RightButton, start_state=start_state)
+        AutoZoomHandler(filter, QtCore.Qt.MidButton, start_state=start_state)
+        return start_state
+
+
+def makeplot(parent):
+    '''Creates a plot in parent with the custom zoom tool and a black
+    background.'''
+    plot = CurvePlot(parent, gridparam=GridParam())
+    pm = PlotManager(parent)
+    pm.add_plot(plot)
+    plot.set_manager(pm, id(plot))
+    pm.add_tool(CustomZoomTool)
+    pm.get_tool(CustomZoomTool).activate()
+    plot.setCanvasBackground(QtCore.Qt.black)
+    plot.setStatusTip(Plot_tooltip)
+    return plot
+
+def makecurve(plot, colour, dotted=False):
+    c = CurveItem()
+    pen = QtGui.QPen(colour)
+    if dotted:
+        pen.setStyle(QtCore.Qt.DotLine)
+    c.setPen(pen)
+    c.attach(plot)
+    return c
+
+
+class KeyFilter(QtCore.QObject):
+    # Implements ctrl-Q or the standard binding for fast exit.
+    def eventFilter(self, watched, event):
+        if event.type() == QtCore.QEvent.KeyPress:
+            key = QtGui.QKeyEvent(event)
+            # \x11 is CTRL-Q, which QKeySequence.Quit doesn't always match.
+            if key.text() == '\x11' or key.matches(QtGui.QKeySequence.Quit):
+                cothread.Quit()
+                return True
+        return False
@@ -0,0 +1,159 @@
+# Background job maintaining a local tile pyramid of archive history
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Builds and extends a fa.zoomer.pyramid from the decimated archive.  On the
+# first pass the whole of the archive is read, after which the archive is polled
+# for its end time and each pass reads only the data added since the last.  The
+# base level of the pyramid determines which archive data is read: DD data where
+# its decimation is fine enough, otherwise D data.
+
+import os
+import sys
+import time
+import optparse
+import numpy
+
+from fa import falib
+from fa.zoomer import pyramid
+
+
+parser = optparse.OptionParser(usage = '''\
+fa-pyramid [options] directory [pv-list]
+
+Builds a min/max/mean tile pyramid of the archive history in the given
+directory, for use by fa-zoomer, and keeps it up to date with the archive
+until interrupted.  The pv-list is a comma separated list of FA ids or ranges
+of ids, and is only used when the pyramid is first created; the default is all
+archived ids.''')
+parser.add_option(
+    '-l', dest = 'base', default = 14, type = 'int',
+    help = 'Base level of a new pyramid: the finest bins hold 2^base FA '
+        'samples, default 14')
+parser.add_option(
+    '-i', dest = 'interval', default = 60, type = 'float',
+    help = 'Interval between updates in seconds, default 60')
+parser.add_option(
+    '-o', dest = 'once', default = False, action = 'store_true',
+    help = 'Bring the pyramid up to date once and exit')
+parser.add_option(
+    '-S', dest = 'server', default = falib.falib.DEFAULT_SERVER,
+    help = 'Specify archive server to read from')
+parser.add_option(
+    '-p', dest = 'port', default = falib.falib.DEFAULT_PORT, type = 'int',
+    help = 'Specify port to connect to on server')
+parser.add_option(
+    '-q', dest = 'quiet', default = False, action = 'store_true',
+    help = 'Suppress display of progress')
+options, args = parser.parse_args()
+
+if not 1 <= len(args) <= 2:
+    parser.error('Must specify directory and optional pv-list')
+directory = args[0]
+
+try:
+    fa_ids = falib.parse_mask(args[1]) if len(args) > 1 else None
+except ValueError as error:
+    parser.error(str(error))
+
+
+def open_pyramid(server):
+    if os.path.exists(os.path.join(directory, pyramid.META_FILE)):
+        result = pyramid.pyramid(directory)
+        if fa_ids is not None and sorted(fa_ids) != result.ids:
+            raise ValueError(
+                'Directory %s holds a pyramid for different ids' % directory)
+        return result
+    else:
+        ids = fa_ids
+        if ids is None:
+            ids = server.get_archived_ids()
+        start, _ = server.get_archive_range()
+        return pyramid.pyramid.create(directory, ids,
+            server.sample_frequency, start, base = options.base)
+
+
+def choose_source(server, base):
+    '''Returns the coarsest archive source that can feed the base level.'''
+    d, dd = server.get_archive_decimations()
+    if 2 ** base >= dd:
+        return 'DD'
+    elif 2 ** base >= d:
+        return 'D'
+    else:
+        raise ValueError('Base level %d is finer than D data' % base)
+
+
+def update(server, pyr, source):
+    '''Reads the archive from the end of the pyramid to the end of the archive
+    and adds it to the pyramid.  Returns the number of samples read.'''
+    archive_start, archive_end = server.get_archive_range()
+    start = max(pyr.end(), archive_start)
+    if archive_end - start < pyr.duration(pyr.base):
+        return 0
+
+    reader = server.archive(pyr.ids, start, end = archive_end,
+        source = source, fields = 7, all_data = True)
+    samples = 0
+    try:
+        offset = reader.offset
+        pending_times = numpy.zeros(0)
+        pending_data = numpy.zeros((0, len(pyr.ids), 3, 2), numpy.float32)
+        for timestamp, duration, _, data in reader:
+            interval = duration / reader.block_size
+            times = 1e-6 * (
+                timestamp + interval * (offset + numpy.arange(len(data))))
+            offset = 0
+            # Store positions in micrometres, as displayed.
+            pending_times, pending_data = pyr.extend(
+                numpy.concatenate((pending_times, times)),
+                numpy.concatenate((pending_data, 1e-3 * data)))
+            samples += len(data)
+            if not options.quiet:
+                sys.stderr.write('%d samples\r' % samples)
+    finally:
+        reader.close()
+    # Samples in the last incomplete bin are read again on the next pass.
+    return samples
+
+
+def main():
+    try:
+        server = falib.Server(server = options.server, port = options.port)
+        pyr = open_pyramid(server)
+        source = choose_source(server, pyr.base)
+    except Exception as error:
+        print('Unable to start: %s' % error, file = sys.stderr)
+        sys.exit(1)
+
+    status = 0
+    try:
+        while True:
+            try:
+                update(server, pyr, source)
+            except Exception as error:
+                # Keep trying: the server may be restarting.
+                print('\nUpdate failed: %s' % error, file = sys.stderr)
+                status = 1
+            if options.once:
+                break
+            time.sleep(options.interval)
+    except KeyboardInterrupt:
+        pass
+    if not options.quiet:
+        sys.stderr.write('\n')
+    sys.exit(status)
@@ -0,0 +1,247 @@
+# Historical browser for the FA archive.
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Python counterpart to the Matlab fa_zoomer.  Rather than reloading each zoomed
+# view from scratch, the archive is read in fixed tiles at each resolution,
+# coarsest first, and the display is redrawn as each tile arrives.  Any change
+# of view cancels the fetches in progress and starts fetching for the new view,
+# and tiles already fetched are reused from the cache.  A local pyramid
+# maintained by fa-pyramid can be used in place of the coarser tiles.
+
+import optparse
+import datetime
+from PyQt5 import QtGui, QtCore, QtWidgets
+import qwt as Qwt5
+
+import cothread
+from fa import falib
+
+from fa.zoomer import tiles, pyramid
+from fa.viewer import tools
+from fa.viewer.modes import X_colour, Y_colour, micrometre
+
+
+DEFAULT_LOCATION = 'SR'
+
+# Largest number of points we draw across the plot; the finest resolution whose
+# samples fit in this is fetched.
+MAX_POINTS = 20000
+
+# Size of tile cache in bytes.
+CACHE_BYTES = 200 * 1024 * 1024
+
+# Delay after the view stops changing before we start fetching, in ms.
+FETCH_DELAY = 200
+
+
+class Zoomer:
+    def __init__(self, server, fa_id, local = None):
+        self.server = server
+        self.fa_id = fa_id
+        self.tiles = tiles.tile_set(server, MAX_POINTS, CACHE_BYTES, local)
+        # Incremented on every change of view, any fetch for an older
+        # generation gives up.
+        self.generation = 0
+
+        self.ui = QtWidgets.QMainWindow()
+        self.ui.setWindowTitle('FA Zoomer')
+        central = QtWidgets.QWidget(self.ui)
+        self.ui.setCentralWidget(central)
+        layout = QtWidgets.QVBoxLayout(central)
+
+        controls = QtWidgets.QHBoxLayout()
+        layout.addLayout(controls)
+        controls.addWidget(QtWidgets.QLabel('FA id', central))
+        self.id_edit = QtWidgets.QLineEdit(str(fa_id), central)
+        self.id_edit.setValidator(
+            QtGui.QIntValidator(0, server.fa_id_count - 1, central))
+        self.id_edit.editingFinished.connect(self.set_fa_id)
+        controls.addWidget(self.id_edit)
+        full = QtWidgets.QPushButton('Full', central)
+        full.clicked.connect(self.show_full)
+        controls.addWidget(full)
+        rescale = QtWidgets.QPushButton('Rescale', central)
+        rescale.clicked.connect(self.rescale)
+        controls.addWidget(rescale)
+        self.show_limits = QtWidgets.QCheckBox('Min/Max', central)
+        self.show_limits.setChecked(True)
+        self.show_limits.stateChanged.connect(self.set_show_limits)
+        controls.addWidget(self.show_limits)
+        controls.addStretch()
+
+        self.makeplot(central)
+        layout.addWidget(self.plot)
+
+        self.status = QtWidgets.QLabel('', self.ui.statusBar())
+        self.ui.statusBar().addWidget(self.status)
+
+        self.timer = QtCore.QTimer()
+        self.timer.setSingleShot(True)
+        self.timer.setInterval(FETCH_DELAY)
+        self.timer.timeout.connect(self.refresh)
+
+        self.base, _ = server.get_archive_range()
+        self.plot.setAxisTitle(Qwt5.QwtPlot.xBottom, 'Time since %s (s)' %
+            datetime.datetime.fromtimestamp(self.base).strftime(
+                '%Y-%m-%d %H:%M:%S'))
+        self.plot.setAxisTitle(
+            Qwt5.QwtPlot.yLeft, 'Position (%s)' % micrometre)
+
+        self.show_full()
+        self.ui.resize(1000, 600)
+        self.ui.show()
+
+    def makeplot(self, parent):
+        plot = tools.makeplot(parent)
+        plot.SIG_PLOT_AXIS_CHANGED.connect(self.view_changed)
+
+        self.plot = plot
+        self.cx = tools.makecurve(plot, X_colour)
+        self.cy = tools.makecurve(plot, Y_colour)
+        self.limits = [
+            tools.makecurve(plot, colour, True)
+            for colour in [X_colour, Y_colour, X_colour, Y_colour]]
+
+
+    # --------------------------------------------------------------------------
+    # GUI event handlers
+
+    def set_fa_id(self):
+        fa_id = int(self.id_edit.text())
+        if fa_id != self.fa_id:
+            self.fa_id = fa_id
+            self.refresh()
+
+    def show_full(self):
+        start, end = self.server.get_archive_range()
+        self.plot.setAxisScale(
+            Qwt5.QwtPlot.xBottom, start - self.base, end - self.base)
+        self.plot.setAxisAutoScale(Qwt5.QwtPlot.yLeft)
+        self.refresh()
+
+    def rescale(self):
+        self.plot.setAxisAutoScale(Qwt5.QwtPlot.yLeft)
+        self.plot.replot()
+
+    def set_show_limits(self, show):
+        for curve in self.limits:
+            curve.setVisible(show != 0)
+        self.plot.replot()
+
+    def view_changed(self, plot):
+        # Wait for the view to settle before fetching anything.
+        self.timer.start()
+
+
+    # --------------------------------------------------------------------------
+    # Fetching and drawing
+
+    def refresh(self):
+        '''Cancels any fetches in progress, draws what we already have for the
+        current view, and starts fetching whatever is missing.'''
+        self.timer.stop()
+        scale = self.plot.axisScaleDiv(Qwt5.QwtPlot.xBottom)
+        self.start = self.base + scale.lowerBound()
+        self.end = self.base + scale.upperBound()
+        self.generation += 1
+        self.redraw()
+        cothread.Spawn(self.fetch, self.generation, self.fa_id)
+
+    def fetch(self, generation, fa_id):
+        cancelled = lambda: generation != self.generation
+        _, archive_end = self.server.get_archive_range()
+        missing = self.tiles.missing(fa_id, self.start, self.end)
+        for n, (source, index) in enumerate(missing):
+            if cancelled():
+                return
+            self.status.setText('Fetching %s data: tile %d of %d' % (
+                source, n + 1, len(missing)))
+            try:
+                if not self.tiles.fetch(
+                        fa_id, source, index, archive_end, cancelled):
+                    return
+            except Exception as error:
+                self.status.setText('Error fetching data: %s' % error)
+                return
+            if not cancelled():
+                self.redraw()
+        self.status.setText('Showing %s data' %
+            self.tiles.target(self.start, self.end))
+
+    def redraw(self):
+        data = self.tiles.compose(self.fa_id, self.start, self.end)
+        if data is not None:
+            times, mean, min, max = data
+            times = times - self.base
+            self.cx.setData(times, mean[:, 0])
+            self.cy.setData(times, mean[:, 1])
+            self.limits[0].setData(times, min[:, 0])
+            self.limits[1].setData(times, min[:, 1])
+            self.limits[2].setData(times, max[:, 0])
+            self.limits[3].setData(times, max[:, 1])
+        self.plot.replot()
+
+
+parser = optparse.OptionParser(usage = '''\
+fa-zoomer [options] [location]
+
+Interactive browser for the FA archive.  The location can be one of %s, or
+full path to location file if -f specified.  The default location is %s.''' % (
+    ', '.join(falib.config.list_location_files()), DEFAULT_LOCATION))
+parser.add_option(
+    '-i', dest = 'fa_id', default = 4, type = 'int',
+    help = 'Initial FA id to display, default is 4')
+parser.add_option(
+    '-d', dest = 'pyramid', default = None,
+    help = 'Directory of local pyramid maintained by fa-pyramid')
+parser.add_option(
+    '-f', dest = 'full_path', default = False, action = 'store_true',
+    help = 'Location is full path to location file')
+parser.add_option(
+    '-S', dest = 'server', default = None,
+    help = 'Override server address in location file')
+parser.add_option(
+    '-P', dest = 'port', default = None,
+    help = 'Override server port in location file')
+options, arglist = parser.parse_args()
+if len(arglist) > 1:
+    parser.error('Unexpected arguments')
+if arglist:
+    location = arglist[0]
+else:
+    location = DEFAULT_LOCATION
+
+falib.load_location_file(
+    globals(), location, options.full_path,
+    server = options.server, port = options.port)
+
+server = falib.Server(server = FA_SERVER, port = FA_PORT)
+
+
+def main():
+    qapp = cothread.iqt()
+    key_filter = tools.KeyFilter()
+    qapp.installEventFilter(key_filter)
+
+    if options.pyramid:
+        local = pyramid.pyramid(options.pyramid)
+    else:
+        local = None
+    zoomer = Zoomer(server, options.fa_id, local)
+
+    cothread.WaitForQuit()
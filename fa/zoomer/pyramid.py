@@ -0,0 +1,214 @@
+# Precomputed min/max/mean pyramid of archive history
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# For each FA id and for each level k from a base level up to a top level the
+# archive history is summarised in bins of 2^k FA samples, each holding the
+# mean, minimum and maximum of X and Y over the bin.  Bins are aligned to a
+# common origin, so bin i of level k+1 summarises bins 2i and 2i+1 of level k.
+# Empty bins, for example during gaps in the archive, are NaN.
+#
+# Each level of each id is an append only file of float32 records, read as a
+# memory mapped array, so a view over any span at any level is a single array
+# slice.  The pyramid is extended by reading the archive from the end of the
+# base level to the end of the archive: completed base bins are appended and
+# each completed pair of bins is merged into the level above.  Nothing else
+# needs to be saved, as the bins waiting for a partner are always the last bin
+# of a level with an odd number of bins more than twice the level above.
+
+import os
+import numpy
+
+
+# Each bin holds mean, min and max for X and Y.
+bin_dtype = numpy.dtype(('<f4', (3, 2)))
+
+META_FILE = 'pyramid.npz'
+
+# Largest number of base bins built in one go.
+MAX_BINS = 65536
+
+
+def merge_pairs(bins):
+    '''Merges consecutive pairs of bins, ignoring empty bins.'''
+    first = bins[0::2]
+    second = bins[1::2]
+    with numpy.errstate(invalid = 'ignore'):
+        mean = numpy.where(numpy.isnan(first[:, 0]), second[:, 0],
+            numpy.where(numpy.isnan(second[:, 0]), first[:, 0],
+                (first[:, 0] + second[:, 0]) / 2))
+    return numpy.stack([
+        mean,
+        numpy.fmin(first[:, 1], second[:, 1]),
+        numpy.fmax(first[:, 2], second[:, 2])], axis = 1)
+
+
+class pyramid:
+    '''p = pyramid(directory)
+
+    Opens an existing pyramid, created with pyramid.create().  The pyramid
+    covers the FA ids in p.ids at levels p.base to p.top, where level k holds
+    bins of 2^k FA samples.  p.read() returns data for display and p.extend()
+    adds new data read from the archive.'''
+
+    @classmethod
+    def create(cls, directory, ids, f_s, start, base = 14, top = 26):
+        '''Creates a new empty pyramid for the given ids starting at or before
+        start seconds, sampled at f_s.'''
+        if not os.path.isdir(directory):
+            os.makedirs(directory)
+        # Align the origin to the top level so that all levels align.
+        top_duration = 2 ** top / f_s
+        origin = numpy.floor(start / top_duration) * top_duration
+        numpy.savez(os.path.join(directory, META_FILE),
+            ids = numpy.array(sorted(ids)), f_s = f_s, origin = origin,
+            base = base, top = top)
+        return cls(directory)
+
+    def __init__(self, directory):
+        self.directory = directory
+        meta = numpy.load(os.path.join(directory, META_FILE))
+        self.ids = [int(id) for id in meta['ids']]
+        self.f_s = float(meta['f_s'])
+        self.origin = float(meta['origin'])
+        self.base = int(meta['base'])
+        self.top = int(meta['top'])
+        self.levels = range(self.base, self.top + 1)
+
+    def filename(self, fa_id, level):
+        return os.path.join(self.directory, '%03d-%02d.dat' % (fa_id, level))
+
+    def duration(self, level):
+        '''Returns the duration of a bin at the given level in seconds.'''
+        return 2 ** level / self.f_s
+
+    def bins(self, fa_id, level):
+        '''Returns a read only memory mapped array of all the bins of the given
+        level, indexed by bin, field (mean, min, max) and X/Y.'''
+        filename = self.filename(fa_id, level)
+        if not os.path.exists(filename) or os.path.getsize(filename) == 0:
+            return numpy.zeros((0, 3, 2), dtype = numpy.float32)
+        return numpy.memmap(filename, dtype = bin_dtype, mode = 'r')
+
+    def count(self, fa_id, level):
+        filename = self.filename(fa_id, level)
+        if os.path.exists(filename):
+            return os.path.getsize(filename) // bin_dtype.itemsize
+        else:
+            return 0
+
+    def end(self):
+        '''Returns the time up to which the pyramid is complete.'''
+        return self.origin + \
+            self.count(self.ids[0], self.base) * self.duration(self.base)
+
+    def level_for(self, start, end, max_points):
+        '''Returns the finest level with no more than max_points bins from
+        start to end, or the top level if none is coarse enough.'''
+        for level in self.levels:
+            if (end - start) / self.duration(level) <= max_points:
+                return level
+        return self.top
+
+    def read(self, fa_id, start, end, max_points):
+        '''Returns (times, mean, min, max) for the given id from start to end
+        at the finest level with at most max_points bins.'''
+        level = self.level_for(start, end, max_points)
+        duration = self.duration(level)
+        bins = self.bins(fa_id, level)
+        first = max(int((start - self.origin) // duration), 0)
+        last = min(int((end - self.origin) // duration) + 1, len(bins))
+        first = min(first, last)
+        data = bins[first:last]
+        times = self.origin + duration * numpy.arange(first, last)
+        # Leave out empty bins, as for gaps in archive reads.
+        valid = ~numpy.isnan(data[:, 0, 0])
+        times, data = times[valid], numpy.array(data[valid])
+        return times, data[:, 0], data[:, 1], data[:, 2]
+
+
+    # --------------------------------------------------------------------------
+    # Extending the pyramid
+
+    def __append(self, fa_id, level, bins):
+        with open(self.filename(fa_id, level), 'ab') as output:
+            output.write(numpy.ascontiguousarray(bins, numpy.float32).tobytes())
+
+    def __add_bins(self, level, bins):
+        '''Appends bins indexed by bin, id, field and X/Y to the given level and
+        merges completed pairs into the levels above.'''
+        while len(bins) and level <= self.top:
+            count = self.count(self.ids[0], level)
+            for n, fa_id in enumerate(self.ids):
+                self.__append(fa_id, level, bins[:, n])
+            if level == self.top:
+                break
+            # If the level above is waiting for the partner of the last bin we
+            # wrote before, fetch it back.
+            if (count - 2 * self.count(self.ids[0], level + 1)) % 2:
+                previous = numpy.stack([
+                    self.bins(fa_id, level)[count - 1]
+                    for fa_id in self.ids], axis = 0)
+                bins = numpy.concatenate((previous[None], bins))
+            pairs = len(bins) // 2
+            bins = numpy.stack([
+                merge_pairs(bins[:2 * pairs, n])
+                for n in range(len(self.ids))], axis = 1)
+            level += 1
+
+    def extend(self, times, data):
+        '''Adds samples with the given times in seconds, indexed by sample,
+        id, field (mean, min, max) and X/Y, to the base level.  Only complete
+        bins are written: samples in the bin of the last sample are returned
+        and should be passed again with the following samples.'''
+        duration = self.duration(self.base)
+        written = self.count(self.ids[0], self.base)
+        index = numpy.int64(numpy.floor((times - self.origin) / duration))
+        # Discard anything we've already written.
+        keep = index >= written
+        times, data, index = times[keep], data[keep], index[keep]
+        if len(index) == 0:
+            return times, data
+        last = index[-1]
+        complete = index < last
+
+        used = index[complete]
+        values = numpy.float64(data[complete])
+        starts = numpy.nonzero(numpy.diff(used))[0] + 1
+        starts = numpy.r_[0, starts] if len(used) else starts
+        counts = numpy.diff(numpy.r_[starts, len(used)])
+        # Bins are written in chunks to bound memory after a long gap.
+        for first in range(written, last, MAX_BINS):
+            bins = numpy.full(
+                (min(MAX_BINS, last - first), len(self.ids), 3, 2), numpy.nan,
+                dtype = numpy.float32)
+            chunk = numpy.nonzero(
+                (used[starts] >= first) & (used[starts] < first + len(bins)))[0]
+            if len(chunk):
+                low = starts[chunk[0]]
+                high = starts[chunk[-1]] + counts[chunk[-1]]
+                offsets = starts[chunk] - low
+                part = values[low:high]
+                slots = used[starts[chunk]] - first
+                bins[slots, :, 0] = numpy.add.reduceat(
+                    part[:, :, 0], offsets) / counts[chunk, None, None]
+                bins[slots, :, 1] = numpy.minimum.reduceat(
+                    part[:, :, 1], offsets)
+                bins[slots, :, 2] = numpy.maximum.reduceat(
+                    part[:, :, 2], offsets)
+            self.__add_bins(self.base, bins)
+        return times[~complete], data[~complete]
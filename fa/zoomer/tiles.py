@@ -0,0 +1,252 @@
+# Client side tile cache for the historical zoom browser
+
+# Copyright (c) 2026 Diamond Light Source Ltd.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Archive data is fetched in tiles of a fixed number of samples at each of the
+# three archive resolutions (DD, D and F), aligned to multiples of the tile
+# duration in the Unix epoch.  Fixed alignment means that panning and zooming
+# keep hitting the same tiles, so recently fetched tiles are kept in a least
+# recently used cache and reused.  A view is drawn from the finest tiles
+# available, falling back to coarser tiles wherever finer ones haven't arrived
+# yet.
+#
+# If a local pyramid built by fa-pyramid is available, tiles no finer than its
+# base level are never fetched over the span the pyramid covers: the pyramid
+# takes their place in the display.
+
+import collections
+import numpy
+
+
+# Samples in each tile.
+TILE_SAMPLES = 4096
+
+# The archive sources in order of increasing resolution.
+SOURCES = ['DD', 'D', 'F']
+
+
+class tile:
+    '''A block of archive data for one FA id at one resolution.  times is in
+    seconds and mean, min and max are indexed by sample and X/Y, all three the
+    same for full rate data.  A tile is partial if it extends beyond the end
+    of the archive when fetched.'''
+
+    def __init__(self, times, mean, min, max, partial):
+        self.times = times
+        self.mean = mean
+        self.min = min
+        self.max = max
+        self.partial = partial
+
+    def nbytes(self):
+        return self.times.nbytes + 3 * self.mean.nbytes
+
+
+def fetch_tile(server, fa_id, source, decimation, start, end, archive_end,
+        cancelled = lambda: False):
+    '''Fetches data for a single tile from start to end seconds, returns a
+    tile or None if cancelled() becomes true before the fetch completes.
+    Data is read block by block so that a fetch can be abandoned part way.
+    Any error other than the server reporting no data in range is raised.'''
+    times = []
+    values = []
+    reader = server.archive_or_none([fa_id], start, end,
+        source = source, fields = 7, all_data = True)
+    if reader is not None:
+        try:
+            offset = reader.offset
+            for timestamp, duration, _, data in reader:
+                if cancelled():
+                    return None
+                interval = duration / reader.block_size
+                times.append(1e-6 * (timestamp + interval * (
+                    offset + numpy.arange(len(data)))))
+                values.append(data[:, 0])
+                offset = 0
+        finally:
+            reader.close()
+
+    if times:
+        times = numpy.concatenate(times)
+        values = 1e-3 * numpy.concatenate(values)
+    else:
+        times = numpy.zeros(0)
+        if decimation > 1:
+            values = numpy.zeros((0, 3, 2))
+        else:
+            values = numpy.zeros((0, 2))
+    if decimation > 1:
+        # Fields are returned in the order mean, min, max.
+        mean, min, max = values[:, 0], values[:, 1], values[:, 2]
+    else:
+        mean = min = max = values
+    return tile(times, mean, min, max, end > archive_end)
+
+
+class tile_cache:
+    '''c = tile_cache(max_bytes)
+
+    Least recently used cache of tiles indexed by (fa_id, source, index),
+    where index is the tile's start time divided by its duration.'''
+
+    def __init__(self, max_bytes):
+        self.max_bytes = max_bytes
+        self.bytes = 0
+        self.tiles = collections.OrderedDict()
+
+    def get(self, key):
+        tile = self.tiles.get(key)
+        if tile is not None:
+            self.tiles.move_to_end(key)
+        return tile
+
+    def put(self, key, tile):
+        old = self.tiles.pop(key, None)
+        if old is not None:
+            self.bytes -= old.nbytes()
+        self.tiles[key] = tile
+        self.bytes += tile.nbytes()
+        while self.bytes > self.max_bytes and len(self.tiles) > 1:
+            _, old = self.tiles.popitem(last = False)
+            self.bytes -= old.nbytes()
+
+    def clear(self):
+        self.tiles.clear()
+        self.bytes = 0
+
+
+class tile_set:
+    '''t = tile_set(server, max_points, max_bytes, pyramid=None)
+
+    Works out which tiles are needed to display a range of time for one FA id
+    and composes the display from the cache and the optional local pyramid.
+    The finest resolution used is the finest giving no more than max_points
+    samples across the range.'''
+
+    def __init__(self, server, max_points, max_bytes, pyramid = None):
+        self.server = server
+        self.max_points = max_points
+        self.pyramid = pyramid
+        self.cache = tile_cache(max_bytes)
+        d, dd = server.get_archive_decimations()
+        self.decimations = {'DD': dd, 'D': d, 'F': 1}
+        self.durations = dict(
+            (source, TILE_SAMPLES * decimation / server.sample_frequency)
+            for source, decimation in self.decimations.items())
+
+    def target(self, start, end):
+        '''Returns the finest source to use to display start to end.'''
+        for source in reversed(SOURCES):
+            points = (end - start) * self.server.sample_frequency / \
+                self.decimations[source]
+            if points <= self.max_points:
+                return source
+        return SOURCES[0]
+
+    def indices(self, source, start, end):
+        duration = self.durations[source]
+        return range(int(start // duration), int(end // duration) + 1)
+
+    def in_pyramid(self, fa_id, source, index):
+        '''Returns true if the given tile can be taken from the pyramid.'''
+        pyramid = self.pyramid
+        if pyramid is None or fa_id not in pyramid.ids or \
+                self.decimations[source] < 2 ** pyramid.base:
+            return False
+        duration = self.durations[source]
+        return pyramid.origin <= index * duration and \
+            (index + 1) * duration <= pyramid.end()
+
+    def missing(self, fa_id, start, end):
+        '''Returns a list of (source, index) for the tiles needed to show start
+        to end which aren't in the cache or the pyramid, coarsest first.'''
+        target = SOURCES.index(self.target(start, end))
+        result = []
+        for source in SOURCES[:target + 1]:
+            for index in self.indices(source, start, end):
+                if self.in_pyramid(fa_id, source, index):
+                    continue
+                tile = self.cache.get((fa_id, source, index))
+                if tile is None or tile.partial:
+                    result.append((source, index))
+        return result
+
+    def fetch(self, fa_id, source, index, archive_end, cancelled):
+        '''Fetches a single tile into the cache, returns False if cancelled.'''
+        duration = self.durations[source]
+        tile = fetch_tile(self.server, fa_id, source,
+            self.decimations[source], index * duration,
+            (index + 1) * duration, archive_end, cancelled)
+        if tile is None:
+            return False
+        self.cache.put((fa_id, source, index), tile)
+        return True
+
+    def __tile_layer(self, fa_id, source, start, end):
+        '''Returns the cached tiles of one source for start to end as a list of
+        parts and the list of intervals they cover.'''
+        duration = self.durations[source]
+        parts = []
+        intervals = []
+        for index in self.indices(source, start, end):
+            tile = self.cache.get((fa_id, source, index))
+            if tile is None:
+                continue
+            parts.append((tile.times, tile.mean, tile.min, tile.max))
+            if tile.partial:
+                if len(tile.times):
+                    intervals.append((index * duration, tile.times[-1]))
+            else:
+                intervals.append((index * duration, (index + 1) * duration))
+        return parts, intervals
+
+    def __pyramid_layer(self, fa_id, start, end):
+        pyramid = self.pyramid
+        parts = [pyramid.read(fa_id, start, end, self.max_points)]
+        return parts, [(pyramid.origin, pyramid.end())]
+
+    def compose(self, fa_id, start, end):
+        '''Returns (times, mean, min, max) for start to end made up from the
+        finest cached tiles and the pyramid, or None if there is nothing to
+        show.'''
+        target = SOURCES.index(self.target(start, end))
+        # Each layer is its decimation and a function returning its data.
+        layers = [
+            (self.decimations[source], lambda source = source:
+                self.__tile_layer(fa_id, source, start, end))
+            for source in SOURCES[:target + 1]]
+        if self.pyramid is not None and fa_id in self.pyramid.ids:
+            level = self.pyramid.level_for(start, end, self.max_points)
+            layers.append((2 ** level,
+                lambda: self.__pyramid_layer(fa_id, start, end)))
+        layers.sort(key = lambda layer: layer[0])
+
+        covered = []            # Intervals already covered by finer layers
+        parts = []
+        for _, layer in layers:
+            layer_parts, intervals = layer()
+            for times, mean, min, max in layer_parts:
+                keep = numpy.ones(len(times), dtype = bool)
+                for low, high in covered:
+                    keep &= (times < low) | (times >= high)
+                parts.append((times[keep], mean[keep], min[keep], max[keep]))
+            covered.extend(intervals)
+        if not parts:
+            return None
+        times, mean, min, max = [numpy.concatenate(p) for p in zip(*parts)]
+        order = numpy.argsort(times, kind = 'stable')
+        return times[order], mean[order], min[order], max[order]